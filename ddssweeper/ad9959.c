@@ -1,5 +1,7 @@
 #include "ad9959.h"
 
+#include "trigger_timer.pio.h"
+
 // =============================================================================
 // calculate tuning words
 // =============================================================================
@@ -43,27 +45,357 @@ double get_pow(double phase, uint8_t* buf) {
     return pow / 16383.0 * 360.0;
 }
 
+// =============================================================================
+// Integer Tuning Words
+// =============================================================================
+
+// Units are ppm of full scale, mHz and millidegrees. The divisions by a
+// constant compile to multiplies, the FTW uses the reciprocal cached in the
+// config so nothing here needs the soft float library.
+
+static uint64_t mul_hi64(uint64_t a, uint64_t b) {
+    // upper 64 bits of the 128 bit product
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+
+    uint64_t lo = a_lo * b_lo;
+    uint64_t mid1 = a_hi * b_lo;
+    uint64_t mid2 = a_lo * b_hi;
+    uint64_t carry = ((lo >> 32) + (uint32_t)mid1 + (uint32_t)mid2) >> 32;
+
+    return a_hi * b_hi + (mid1 >> 32) + (mid2 >> 32) + carry;
+}
+
+static void update_recip(ad9959_config* c) {
+    c->sys_clk_milli = (uint64_t)c->ref_clk * c->pll_mult * 1000;
+    if (c->sys_clk_milli == 0) return;
+
+    // long division of 2^96, the quotient fits as long as the system clock is
+    // above 2^32 mHz (4.3 MHz)
+    uint64_t d = c->sys_clk_milli;
+    uint64_t r = 1, q = 0;
+    for (int i = 0; i < 96; i++) {
+        r <<= 1;
+        q <<= 1;
+        if (r >= d) {
+            r -= d;
+            q |= 1;
+        }
+    }
+    c->ftw_recip = q;
+}
+
+uint32_t get_asf_ppm(uint32_t amp, uint8_t* buf) {
+    uint32_t asf = ((uint64_t)amp * 1024 + 500000) / 1000000;
+
+    if (asf > 1023) asf = 1023;
+    if (asf < 1) asf = 1;
+
+    buf[0] = 0x00;
+    buf[1] = ((0x300 & asf) >> 8) | 0x10;
+    buf[2] = 0xff & asf;
+
+    return asf;
+}
+
+uint32_t get_ftw_mhz(ad9959_config* c, uint64_t freq, uint8_t* buf) {
+    // freq * 2^32 / sys_clk, the reciprocal estimate is at most 2 low
+    uint64_t d = c->sys_clk_milli;
+    uint64_t q = mul_hi64(freq, c->ftw_recip);
+
+    // the remainder is small, so it can be worked out modulo 2^64
+    uint64_t r = (freq << 32) - q * d;
+    while (r >= d) {
+        r -= d;
+        q++;
+    }
+    // round half up like round()
+    if (r >= d - r) q++;
+
+    uint32_t ftw = q;
+    buf[0] = ftw >> 24;
+    buf[1] = ftw >> 16;
+    buf[2] = ftw >> 8;
+    buf[3] = ftw;
+
+    return ftw;
+}
+
+uint32_t get_pow_mdeg(uint32_t phase, uint8_t* buf) {
+    uint32_t pow = ((uint64_t)phase * 16384 + 180000) / 360000;
+
+    // same wrap as get_pow
+    pow = pow % 16383;
+
+    buf[0] = (0xff00 & pow) >> 8;
+    buf[1] = 0xff & pow;
+
+    return pow;
+}
+
+// =============================================================================
+// Serial Port
+// =============================================================================
+
+// With SERIAL_BITS 4 a PIO state machine clocks the AD9959 in 4-bit serial
+// mode, otherwise spi1 does it a bit at a time. Everything below hides which
+// one is in use.
+#define SERIAL_PIO pio1
+#define SERIAL_SM 2
+
+static int spi_dma = -1;
+static uint quad_data_pin, quad_clk_pin;
+
+void serial_quad_init(uint data_pin, uint clk_pin) {
+    quad_data_pin = data_pin;
+    quad_clk_pin = clk_pin;
+    uint offset = pio_add_program(SERIAL_PIO, &quad_serial_program);
+    quad_serial_program_init(SERIAL_PIO, SERIAL_SM, offset, data_pin, clk_pin);
+}
+
+void serial_quad_pins() {
+    // hands the data and clock pins back to the 4-bit program after
+    // something else has driven them
+    for (uint i = 0; i < 4; i++) pio_gpio_init(SERIAL_PIO, quad_data_pin + i);
+    pio_gpio_init(SERIAL_PIO, quad_clk_pin);
+}
+
+static bool quad_busy() {
+    if (!pio_sm_is_tx_fifo_empty(SERIAL_PIO, SERIAL_SM)) return true;
+    // the last byte is out once the program stalls on the empty FIFO
+    uint32_t stall = 1u << (PIO_FDEBUG_TXSTALL_LSB + SERIAL_SM);
+    SERIAL_PIO->fdebug = stall;
+    return !(SERIAL_PIO->fdebug & stall);
+}
+
+static void quad_put(uint8_t byte) {
+    // the program shifts out the top of the word
+    pio_sm_put_blocking(SERIAL_PIO, SERIAL_SM, (uint32_t)byte << 24);
+}
+
+static void quad_write_single(const uint8_t* buf, size_t len) {
+    // single bit writes, for when the AD9959 is not in 4-bit mode. Each bit
+    // gets a clock to itself on SDIO_0 with the other lines low.
+    for (size_t i = 0; i < len; i++) {
+        for (int bit = 6; bit >= 0; bit -= 2) {
+            quad_put(((buf[i] >> (bit + 1)) & 1) << 4 | ((buf[i] >> bit) & 1));
+        }
+    }
+    while (quad_busy()) tight_loop_contents();
+}
+
+void serial_write(const uint8_t* buf, size_t len) {
+    if (SERIAL_BITS == 4) {
+        for (size_t i = 0; i < len; i++) quad_put(buf[i]);
+        while (quad_busy()) tight_loop_contents();
+    } else {
+        spi_write_blocking(spi1, buf, len);
+    }
+}
+
 // =============================================================================
 // Sending Tuning Words
 // =============================================================================
 void send_channel(uint8_t reg, uint8_t channel, uint8_t* buf, size_t len) {
-    uint8_t csr[] = {0x00, 0x02 | (1u << (channel + 4))};
-    spi_write_blocking(spi1, csr, 2);
-    spi_write_blocking(spi1, &reg, 1);
-    spi_write_blocking(spi1, buf, len);
+    // CSR and the register go out as one write
+    uint8_t frame[2 + 1 + 4];
+    uint8_t* end = put_csr(frame, 1u << channel);
+    end = put_reg(end, reg, buf, len);
+    serial_write(frame, end - frame);
+}
+
+void send_frame(const uint8_t* buf, size_t len) {
+    // a whole frame in one DMA transfer, back before IO_UPDATE may go out
+    spi_write_dma(buf, len);
+    spi_dma_wait();
 }
 
 void send(uint8_t reg, uint8_t* buf, size_t len) {
-    spi_write_blocking(spi1, &reg, 1);
-    spi_write_blocking(spi1, buf, len);
+    serial_write(&reg, 1);
+    serial_write(buf, len);
+}
+
+// =============================================================================
+// Building Frames
+// =============================================================================
+uint8_t* put_reg(uint8_t* ins, uint8_t reg, const uint8_t* buf, size_t len) {
+    *ins++ = reg;
+    memcpy(ins, buf, len);
+    return ins + len;
+}
+
+size_t reg_size(uint8_t reg) {
+    // bytes of data after the address, CSR to LSRR differ and the rest are 4
+    static const uint8_t sizes[] = {1, 3, 2, 3, 4, 2, 3, 2};
+    return reg < sizeof sizes ? sizes[reg] : 4;
+}
+
+uint8_t* put_csr(uint8_t* ins, uint8_t channels) {
+    // channels is a mask with bit n for channel n, 3-wire serial mode
+    uint8_t csr = CSR_MODE | (channels & 0x0f) << 4;
+    return put_reg(ins, 0x00, &csr, 1);
+}
+
+uint8_t* put_tone(uint8_t* ins, uint8_t channels, const uint8_t* ftw, const uint8_t* pow,
+                  const uint8_t* asf) {
+    // the registers that are not NULL, for every channel in the mask. They
+    // all sit in the I/O buffers until the same IO_UPDATE.
+    ins = put_csr(ins, channels);
+    if (ftw) ins = put_reg(ins, 0x04, ftw, 4);
+    if (pow) ins = put_reg(ins, 0x05, pow, 2);
+    if (asf) ins = put_reg(ins, 0x06, asf, 3);
+    return ins;
+}
+
+uint8_t* put_ss_reg(ad9959_config* c, uint8_t* ins, int kind, double value) {
+    // kind: 0 = amplitude, 1 = frequency, 2 = phase
+    uint8_t buf[4];
+    if (kind == 0) {
+        get_asf(value, buf);
+        return put_reg(ins, 0x06, buf, 3);
+    } else if (kind == 1) {
+        get_ftw(c, value, buf);
+        return put_reg(ins, 0x04, buf, 4);
+    } else {
+        get_pow(value, buf);
+        return put_reg(ins, 0x05, buf, 2);
+    }
+}
+
+void get_sweep_word(ad9959_config* c, int kind, double value, uint8_t* buf) {
+    // sweep registers hold the value msb aligned in a 32 bit word
+    uint8_t tw[4];
+    uint32_t word;
+    if (kind == 0) {
+        get_asf(value, tw);
+        word = (((tw[1] & 0x03) << 8) | tw[2]) << 22;
+    } else if (kind == 1) {
+        get_ftw(c, value, buf);
+        return;
+    } else {
+        get_pow(value, tw);
+        word = ((tw[0] << 8) | tw[1]) << 18;
+    }
+    for (int i = 0; i < 4; i++) {
+        buf[i] = word >> (24 - 8 * i);
+    }
+}
+
+uint8_t* put_sweep(ad9959_config* c, uint8_t* ins, int kind, double start, double end,
+                   double delta, uint rate) {
+    // the AD9959 always sweeps from S0 up to CW1 when its profile pin is high
+    // and back down when it is low, so descending sweeps swap the end points
+    // and are played by dropping the pin instead. The unused direction gets
+    // the largest step so the pin flip during IO_UPDATE snaps the output to
+    // the starting point first.
+    bool up = end >= start;
+    uint8_t fast[4] = {0xff, 0xff, 0xff, 0xff};
+    uint8_t word[4];
+
+    // CFR: sweep the selected parameter with full scale DAC current
+    uint8_t cfr[] = {(kind + 1) << 6, 0x43, 0x00};
+    ins = put_reg(ins, 0x03, cfr, 3);
+
+    ins = put_ss_reg(c, ins, kind, up ? start : end);
+
+    get_sweep_word(c, kind, up ? end : start, word);
+    ins = put_reg(ins, 0x0a, word, 4);
+
+    uint8_t lsrr[] = {up ? 1 : rate, up ? rate : 1};
+    ins = put_reg(ins, 0x07, lsrr, 2);
+
+    get_sweep_word(c, kind, delta, word);
+    ins = put_reg(ins, 0x08, up ? word : fast, 4);
+    ins = put_reg(ins, 0x09, up ? fast : word, 4);
+    return ins;
+}
+
+// =============================================================================
+// DMA transfers
+// =============================================================================
+void spi_dma_init() {
+    spi_dma = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(spi_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    if (SERIAL_BITS == 4) {
+        // byte writes to the FIFO land in every lane, the program takes the top
+        channel_config_set_dreq(&c, pio_get_dreq(SERIAL_PIO, SERIAL_SM, true));
+        dma_channel_configure(spi_dma, &c, &SERIAL_PIO->txf[SERIAL_SM], NULL, 0, false);
+    } else {
+        channel_config_set_dreq(&c, spi_get_dreq(spi1, true));
+        dma_channel_configure(spi_dma, &c, &spi_get_hw(spi1)->dr, NULL, 0, false);
+    }
+}
+
+void spi_write_dma(const uint8_t* buf, size_t len) {
+    // never retarget a transfer that is still going
+    dma_channel_wait_for_finish_blocking(spi_dma);
+    dma_channel_transfer_from_buffer_now(spi_dma, buf, len);
+}
+
+void spi_dma_wait() {
+    dma_channel_wait_for_finish_blocking(spi_dma);
+    if (SERIAL_BITS == 4) {
+        while (quad_busy()) tight_loop_contents();
+        return;
+    }
+    while (spi_is_busy(spi1)) tight_loop_contents();
+
+    // nothing reads the bytes clocked in while writing, so drop them along
+    // with the overrun flag before anyone tries to read back
+    while (spi_is_readable(spi1)) (void)spi_get_hw(spi1)->dr;
+    spi_get_hw(spi1)->icr = SPI_SSPICR_RORIC_BITS;
+}
+
+bool spi_dma_busy() {
+    // true until the last bit of the frame is out, like spi_dma_wait
+    if (dma_channel_is_busy(spi_dma)) return true;
+    return SERIAL_BITS == 4 ? quad_busy() : spi_is_busy(spi1);
 }
 
 // =============================================================================
 // Readback
 // =============================================================================
 
+// channels selected in CSR for the registers read_reg reads
+static uint8_t read_channels = 0xf0;
+
+static void quad_read(uint8_t reg, size_t len, uint8_t* buf) {
+    // replies only come back on SDIO_2 in 3-wire mode, so drop out of 4-bit
+    // mode for the read and clock the reply in by hand with the program
+    // stopped
+    uint8_t csr[] = {0x00, read_channels | 0x02};
+    serial_write(csr, 2);
+    quad_write_single(&reg, 1);
+
+    uint sdo = quad_data_pin + 2;
+    uint32_t clk = 1u << quad_clk_pin;
+    pio_sm_set_enabled(SERIAL_PIO, SERIAL_SM, false);
+    pio_sm_set_pindirs_with_mask(SERIAL_PIO, SERIAL_SM, 0, 1u << sdo);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = 0;
+        for (int bit = 0; bit < 8; bit++) {
+            buf[i] = buf[i] << 1 | gpio_get(sdo);
+            pio_sm_set_pins_with_mask(SERIAL_PIO, SERIAL_SM, clk, clk);
+            pio_sm_set_pins_with_mask(SERIAL_PIO, SERIAL_SM, 0, clk);
+        }
+    }
+    pio_sm_set_pindirs_with_mask(SERIAL_PIO, SERIAL_SM, 1u << sdo, 1u << sdo);
+    pio_sm_set_enabled(SERIAL_PIO, SERIAL_SM, true);
+
+    csr[1] = read_channels | CSR_MODE;
+    quad_write_single(csr, 2);
+}
+
 void read_reg(uint8_t reg, size_t len, uint8_t* buf) {
     reg |= 0x80;
+    if (SERIAL_BITS == 4) {
+        quad_read(reg, len, buf);
+        return;
+    }
     spi_write_blocking(spi1, &reg, 1);
     spi_read_blocking(spi1, 0, buf, len);
 }
@@ -85,9 +417,9 @@ void read_all() {
     for (int i = 0; i < 4; i++) {
         printf("CHANNEL %d:\n", i);
 
-        uint8_t csr[] = {0x00, (1u << (i + 4)) | 0x02};
-
-        spi_write_blocking(spi1, csr, 2);
+        uint8_t csr[2];
+        read_channels = 1u << (i + 4);
+        serial_write(csr, put_csr(csr, 1u << i) - csr);
 
         read_reg(0x03, 3, resp);
         printf(" CFR: %02x %02x %02x\n", resp[0], resp[1], resp[2]);
@@ -114,6 +446,7 @@ void read_all() {
         printf(" CW1: %02x %02x %02x %02x\n", resp[0], resp[1], resp[2], resp[3]);
     }
     spi_set_baudrate(spi1, 100 * MHZ);
+    read_channels = 0xf0;
 }
 
 // =============================================================================
@@ -127,28 +460,44 @@ void set_pll_mult(ad9959_config* c, uint mult) {
         vco = 0x80;
     }
 
+    update_recip(c);
+
     uint8_t fr1[] = {0x01, vco | (mult << 2), 0x00, 0x00};
-    spi_write_blocking(spi1, fr1, 4);
+    serial_write(fr1, 4);
 
     // for (int i = 0; i < 4; i++) {
     //     printf("%02x\n", fr1[i]);
     // }
 }
 
-void set_ref_clk(ad9959_config* c, uint64_t freq) { c->ref_clk = freq; }
+void set_ref_clk(ad9959_config* c, uint64_t freq) {
+    c->ref_clk = freq;
+    update_recip(c);
+}
+
+void set_io_mode() {
+    // the AD9959 comes out of reset taking single bit writes, the first
+    // write after one switches it to the mode the serial port uses
+    uint8_t csr[] = {0x00, 0xf0 | CSR_MODE};
+    if (SERIAL_BITS == 4) {
+        quad_write_single(csr, 2);
+    } else {
+        serial_write(csr, 2);
+    }
+}
 
 void single_step_mode() {
-    uint8_t csr = 0xf2;
+    uint8_t csr = 0xf0 | CSR_MODE;
     send(0x00, &csr, 1);
     uint8_t cfr[3] = {0x00, 0x03, 0x00};
     send(0x03, cfr, 3);
 }
 
 void clear() {
-    uint8_t clear[] = {0x00, 0xf2, 0x03, 0x00, 0x03, 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x05,
+    uint8_t clear[] = {0x00, 0xf0 | CSR_MODE, 0x03, 0x00, 0x03, 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x05,
                        0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0x07, 0x00, 0x00, 0x08, 0x00, 0x00,
                        0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x00,
                        0x02, 0x00, 0x00};
 
-    spi_write_blocking(spi1, clear, sizeof clear);
+    serial_write(clear, sizeof clear);
 }
@@ -7,15 +7,31 @@
 #include <string.h>
 
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
 #include "hardware/spi.h"
 #include "hardware/structs/watchdog.h"
 #include "pico/stdlib.h"
 
+// width of the serial port to the AD9959. 1 is single bit SPI on spi1 in
+// 3-wire mode, 4 is 4-bit serial mode clocked by a PIO program on
+// SDIO_0-3. Set with the SERIAL_BITS cache variable in CMakeLists.txt.
+#ifndef SERIAL_BITS
+#define SERIAL_BITS 1
+#endif
+
+// I/O mode bits that go in every CSR write
+#define CSR_MODE (SERIAL_BITS == 4 ? 0x06 : 0x02)
+
 typedef struct ad9959_config {
     double ref_clk;
     uint32_t pll_mult;
     int sweep_type;
     uint channels;
+    // system clock in mHz and floor(2^96 / sys_clk_milli), kept up to date by
+    // set_ref_clk and set_pll_mult for the integer tuning word path
+    uint64_t sys_clk_milli;
+    uint64_t ftw_recip;
 } ad9959_config;
 
 // get tuning words
@@ -23,9 +39,42 @@ double get_asf(double amp, uint8_t* buf);
 double get_ftw(ad9959_config* c, double freq, uint8_t* buf);
 double get_pow(double phase, uint8_t* buf);
 
+// get tuning words without floating point, these round the same way as the
+// functions above and return the tuning word
+uint32_t get_asf_ppm(uint32_t amp, uint8_t* buf);
+uint32_t get_ftw_mhz(ad9959_config* c, uint64_t freq, uint8_t* buf);
+uint32_t get_pow_mdeg(uint32_t phase, uint8_t* buf);
+
+// build register writes into a frame, each returns the end of what it wrote.
+// kind is 0 = amplitude, 1 = frequency, 2 = phase
+uint8_t* put_reg(uint8_t* ins, uint8_t reg, const uint8_t* buf, size_t len);
+uint8_t* put_csr(uint8_t* ins, uint8_t channels);
+size_t reg_size(uint8_t reg);
+
+// CSR then CFTW, CPOW and ACR, any of which may be NULL, at most this long
+#define TONE_FRAME_MAX 14
+uint8_t* put_tone(uint8_t* ins, uint8_t channels, const uint8_t* ftw, const uint8_t* pow,
+                  const uint8_t* asf);
+uint8_t* put_ss_reg(ad9959_config* c, uint8_t* ins, int kind, double value);
+void get_sweep_word(ad9959_config* c, int kind, double value, uint8_t* buf);
+uint8_t* put_sweep(ad9959_config* c, uint8_t* ins, int kind, double start, double end,
+                   double delta, uint rate);
+
+// serial port, spi1 or the 4-bit PIO program
+void serial_quad_init(uint data_pin, uint clk_pin);
+void serial_quad_pins();
+void serial_write(const uint8_t* buf, size_t len);
+
 // send tuning words
 void send_channel(uint8_t reg, uint8_t channel, uint8_t* buf, size_t len);
 void send(uint8_t reg, uint8_t* buf, size_t len);
+void send_frame(const uint8_t* buf, size_t len);
+
+// DMA transfers
+void spi_dma_init();
+void spi_write_dma(const uint8_t* buf, size_t len);
+void spi_dma_wait();
+bool spi_dma_busy();
 
 // Readback from AD9959
 void read_reg(uint8_t reg, size_t len, uint8_t* buf);
@@ -34,6 +83,7 @@ void read_all();
 // control
 void set_pll_mult(ad9959_config* c, uint mult);
 void set_ref_clk(ad9959_config* c, uint64_t freq);
+void set_io_mode();
 void single_step_mode();
 void clear();
 
@@ -20,7 +20,11 @@
 #######################################################################
 */
 
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #define MAX_POINTS 13
@@ -30,6 +34,7 @@
 #include "hardware/flash.h"
 #include "hardware/pio.h"
 #include "hardware/spi.h"
+#include "hardware/structs/systick.h"
 #include "pico/multicore.h"
 #include "pico/stdlib.h"
 #include "trigger_timer.pio.h"
@@ -44,11 +49,16 @@
 #define PIN_CLOCK 21
 #define PIN_UPDATE 22
 #define PIN_RESET 9
+// 4-bit serial mode has SDIO_0-3 on consecutive pins and its own SCLK
+#define PIN_SDIO0 2
+#define PIN_SCLK 6
 #define P0 19
 #define P1 18
 #define P2 17
 #define P3 16
 #define TRIGGER 8
+// digital input that control records test, e.g. atom present from the camera
+#define PIN_FEEDBACK 20
 
 #define PIO_TRIG pio0
 #define PIO_TIME pio1
@@ -78,16 +88,80 @@ int status = STOPPED;
 
 // PIO VALUES IT IS LOOKING FOR
 #define UPDATE 0
+// profile pins are not used in single step mode, so just hold them steady
+#define SS_TRIGGER 0xff
+
+// pseudo channels used by the set command to end a table or add a control
+// record
+#define STOP_CHANNEL 4
+#define REPEAT_CHANNEL 5
+#define WAIT_CHANNEL 6
+#define JUMP_CHANNEL 7
+#define LOOP_CHANNEL 8
+#define CALL_CHANNEL 9
+#define RETURN_CHANNEL 10
+
+// control records have a zero trigger byte followed by one of these. Stop
+// and repeat end the table, the others run in place. Jump, loop and call
+// targets are an instruction address in the 4 bytes after, loops have their
+// count in the 4 bytes after that.
+#define CTRL_STOP 0
+#define CTRL_REPEAT 1
+#define CTRL_WAIT_LOW 2
+#define CTRL_WAIT_HIGH 3
+#define CTRL_JUMP 4
+#define CTRL_JUMP_LOW 5
+#define CTRL_JUMP_HIGH 6
+#define CTRL_LOOP 7
+#define CTRL_CALL 8
+#define CTRL_RETURN 9
+// the op and both arguments
+#define CTRL_SIZE 9
+// loops and calls that can be open at once
+#define CALL_DEPTH 8
+
+// instruction sizes (per channel) for each mode, see set_single_step/set_sweep
+static const uint ins_sizes[] = {14, 28, 29, 27, 36, 36, 36};
+// the longest raw record, four channels of the largest instruction
+#define MAX_RECORD (4 * 36 + 1)
 
 #define MAX_SIZE 249856
 #define TIMERS 5000
-#define TIMING_OFFSET (MAX_SIZE - TIMERS * 4)
-
-// minimum wait lengths
-#define WAITS_SS_PER 250
-#define WAITS_SS_BASE (500 - WAITS_SS_PER)
-#define WAITS_SW_PER 500
-#define WAITS_SW_BASE (1000 - WAITS_SW_PER)
+// the timing table sits at the end of each bank
+#define TIMING_OFFSET (bank_size - TIMERS * 4)
+
+// the instruction buffer can be split into banks that are filled while
+// another one runs
+#define MAX_BANKS 4
+#define END_OF_TABLE 0
+#define NEXT_TRIGGER 1
+
+// start messages for core1 are the bank to run and these flags. With
+// START_FLASH it is a flash slot instead of a bank.
+#define START_HW 1
+#define START_STREAM 2
+#define START_FLASH 4
+#define START_BANK_SHIFT 3
+// not a start message, core1 waits in RAM until the flash has been written
+#define PARK_CORE1 0xffffffff
+
+// minimum wait lengths, the part per channel is mostly the time the frame
+// takes on the serial port. The fixed part covers what core1 does between
+// an IO_UPDATE and the next frame starting, the DMA only takes over the
+// bytes once they go out. A frame cannot be queued any earlier: it would
+// land in the AD9959's I/O buffer on top of the one still waiting for its
+// IO_UPDATE, so DMA frees core1 but does not shorten a step.
+#define WAITS_SS_PER (SERIAL_BITS == 4 ? 80 : 250)
+#define WAITS_SS_BASE 250
+#define WAITS_SW_PER (SERIAL_BITS == 4 ? 160 : 500)
+#define WAITS_SW_BASE 500
+
+// cycles the timer program spends per wait on top of the programmed count
+#define TIMER_OVERHEAD 10
+
+// binary upload chunks are a 2 byte length, the payload and a 4 byte crc32
+#define BULK_HEADER 2
+#define BULK_TRAILER 4
 
 // For responding OK to successful commands
 #define OK() printf("ok\n")
@@ -105,8 +179,64 @@ uint triggers;
 uint timer_dma;
 
 uint INS_SIZE = 0;
+uint palette_size = 0;
+uint palette_used = 0;
+bool sparse = false;
 uint8_t instructions[MAX_SIZE];
 
+// a sparse bank starts with this, the records follow it
+typedef struct sparse_header {
+    uint32_t records;
+    // bytes of records and where the last one starts
+    uint32_t used;
+    uint32_t last;
+    // where the index of the records is, 0 until the table has been ended
+    uint32_t index_at;
+} sparse_header;
+#define SPARSE_HEADER sizeof(sparse_header)
+
+// layout of the table in each bank, the globals above describe the bank that
+// is being edited
+typedef struct table_bank {
+    int sweep_type;
+    uint channels;
+    uint ins_size;
+    bool timing;
+    // entries reserved for a packed table and how many are filled, see
+    // Packed Tables. A table with no palette is raw records.
+    uint palette_size;
+    uint palette_used;
+    // variable length records, see Sparse Tables
+    bool sparse;
+} table_bank;
+
+table_bank banks[MAX_BANKS];
+uint num_banks = 1;
+uint bank_size = MAX_SIZE;
+uint edit_bank = 0;
+uint8_t *table = instructions;
+
+// the bank core1 is running, written by core1 in prepare_bank()
+volatile uint run_bank = 0;
+// a bank to swap to, or -1. Set by core0 in cmd_swap(), core1 clears it
+// once it has swapped or the run has ended.
+volatile int pending_bank = -1;
+// when to swap, written by core0 before it sets pending_bank
+volatile int swap_when = END_OF_TABLE;
+
+// streamed records go through a ring in the bank being edited. head is only
+// written by core0 and tail only by core1, both count records and wrap.
+struct {
+    uint8_t *base;
+    uint record;
+    uint slots;
+    volatile uint head;
+    volatile uint tail;
+    volatile bool primed;
+    volatile bool done;
+    volatile uint underruns;
+} stream;
+
 // =============================================================================
 // Utility Functions
 // =============================================================================
@@ -118,10 +248,14 @@ void init_pin(uint pin) {
 }
 
 void init_pio() {
-    uint offset = pio_add_program(PIO_TRIG, &trigger_program);
-    trigger_program_init(PIO_TRIG, 0, offset, TRIGGER, P3, PIN_UPDATE);
-    offset = pio_add_program(PIO_TIME, &timer_program);
-    timer_program_init(PIO_TIME, 0, offset, TRIGGER);
+    // the programs are only loaded once, an abort restarts the state machines
+    static int trig_offset = -1, time_offset = -1;
+    if (trig_offset < 0) {
+        trig_offset = pio_add_program(PIO_TRIG, &trigger_program);
+        time_offset = pio_add_program(PIO_TIME, &timer_program);
+    }
+    trigger_program_init(PIO_TRIG, 0, trig_offset, TRIGGER, P3, PIN_UPDATE);
+    timer_program_init(PIO_TIME, 0, time_offset, TRIGGER);
 }
 
 int get_status() {
@@ -137,67 +271,43 @@ void set_status(int new_status) {
     mutex_exit(&status_mutex);
 }
 
-float cubicSplineInterpolation(float x[MAX_POINTS], float y[MAX_POINTS], int n, float resultX) {
-    float h[MAX_POINTS - 1];
-    float alpha[MAX_POINTS - 1];
-    float l[MAX_POINTS];
-    float mu[MAX_POINTS - 1];
-    float z[MAX_POINTS];
-    float c[MAX_POINTS];
-    float b[MAX_POINTS];
-    float d[MAX_POINTS];
-
-    // Step 1: Compute h and alpha
-    for (int i = 0; i < n - 1; i++) {
-        h[i] = x[i + 1] - x[i];
-        alpha[i] = (3.0 / h[i]) * (y[i + 1] - y[i]) - (3.0 / h[i - 1]) * (y[i] - y[i - 1]);
-    }
-
-    // Step 2: Compute l, mu, and z
-    l[0] = 1.0;
-    mu[0] = 0.0;
-    z[0] = 0.0;
-
-    for (int i = 1; i < n - 1; i++) {
-        l[i] = 2.0 * (x[i + 1] - x[i - 1]) - h[i - 1] * mu[i - 1];
-        mu[i] = h[i] / l[i];
-        z[i] = (alpha[i] - h[i - 1] * z[i - 1]) / l[i];
-    }
+void save_layout() {
+    banks[edit_bank] = (table_bank){ad9959.sweep_type, ad9959.channels, INS_SIZE, timing,
+                                    palette_size, palette_used, sparse};
+}
 
-    l[n - 1] = 1.0;
-    z[n - 1] = 0.0;
-    c[n - 1] = 0.0;
+void restore_layout() {
+    ad9959.sweep_type = banks[edit_bank].sweep_type;
+    ad9959.channels = banks[edit_bank].channels;
+    INS_SIZE = banks[edit_bank].ins_size;
+    timing = banks[edit_bank].timing;
+    palette_size = banks[edit_bank].palette_size;
+    palette_used = banks[edit_bank].palette_used;
+    sparse = banks[edit_bank].sparse;
+}
 
-    // Step 3: Back-substitution
-    for (int j = n - 2; j >= 0; j--) {
-        c[j] = z[j] - mu[j] * c[j + 1];
-        b[j] = (y[j + 1] - y[j]) / h[j] - h[j] * (c[j + 1] + 2.0 * c[j]) / 3.0;
-        d[j] = (c[j + 1] - c[j]) / (3.0 * h[j]);
-    }
+void select_bank(uint bank) {
+    save_layout();
+    edit_bank = bank;
+    table = instructions + bank * bank_size;
 
-    // Step 4: Interpolation
-    int interval = -1;
-    for (int i = 0; i < n - 1; i++) {
-        if (resultX >= x[i] && resultX <= x[i + 1]) {
-            interval = i;
-            break;
-        }
-    }
+    restore_layout();
+}
 
-    if (interval == -1) {
-        printf("Error: Data point outside the range of interpolation.\n");
-        return 0;
+void split_banks(uint n) {
+    // every bank starts out with the layout currently being edited
+    save_layout();
+    num_banks = n;
+    bank_size = (MAX_SIZE / n) & ~3u;
+    for (uint i = 0; i < n; i++) {
+        banks[i] = banks[edit_bank];
+        // a sparse bank keeps its place in the bank, which has just moved
+        if (banks[i].sparse) memset(instructions + i * bank_size, 0, SPARSE_HEADER);
     }
-
-    // Evaluate the cubic spline at the desired point
-    float deltaX = resultX - x[interval];
-    float interpolationResult = y[interval] + b[interval] * deltaX + c[interval] * deltaX * deltaX + d[interval] * deltaX * deltaX * deltaX;
-
-    printf("Interpolated value at x = %.2f: %.4f\n", resultX, interpolationResult);
-    return interpolationResult;
+    edit_bank = 0;
+    table = instructions;
 }
 
-
 void measure_freqs(void) {
     // From https://github.com/raspberrypi/pico-examples under BSD-3-Clause License
     uint f_pll_sys = frequency_count_khz(CLOCKS_FC0_SRC_VALUE_PLL_SYS_CLKSRC_PRIMARY);
@@ -233,9 +343,204 @@ void readline() {
     }
 }
 
+void read_bytes(uint8_t *buf, size_t len) {
+    // stdin is unbuffered, so this reads straight into buf without eating
+    // into whatever the host sends next
+    size_t got = 0;
+    while (got < len) {
+        got += fread(buf + got, 1, len - got, stdin);
+    }
+}
+
+uint32_t crc32(uint32_t crc, const uint8_t *buf, size_t len) {
+    // CRC-32 (IEEE 802.3, same as zlib.crc32) using a nibble table to keep it
+    // small but still fast enough to keep up with USB
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+        0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+void skip_bytes(size_t len) {
+    // reads len bytes and drops them, to stay in step with the host
+    uint8_t buf[64];
+    while (len > 0) {
+        size_t n = len < sizeof buf ? len : sizeof buf;
+        read_bytes(buf, n);
+        len -= n;
+    }
+}
+
+void bulk_load(uint start, uint len) {
+    // Writes len bytes into instructions[] starting at start. The host sends
+    // length prefixed chunks, each followed by its crc32, and has to wait for
+    // the response before sending the next one:
+    //   "ok"  - chunk was good and has been written
+    //   "crc" - checksum did not match, resend the same chunk
+    // A zero length chunk abandons the upload. A chunk longer than what is
+    // left is read and dropped and ends the upload with "Invalid Chunk".
+    uint received = 0;
+    uint8_t header[BULK_HEADER];
+    uint8_t trailer[BULK_TRAILER];
+
+    printf("ready\n");
+    while (received < len) {
+        read_bytes(header, BULK_HEADER);
+        uint chunk = header[0] | (header[1] << 8);
+
+        if (chunk == 0) {
+            printf("Upload aborted after %u bytes\n", received);
+            return;
+        }
+        if (chunk > len - received) {
+            skip_bytes(chunk + BULK_TRAILER);
+            printf("Invalid Chunk - %u bytes would overrun the %u bytes left\n", chunk,
+                   len - received);
+            return;
+        }
+
+        // payload goes straight into the table, on a bad crc it just gets
+        // overwritten by the resend
+        uint8_t *dest = table + start + received;
+        read_bytes(dest, chunk);
+        read_bytes(trailer, BULK_TRAILER);
+
+        uint32_t expected = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) |
+                            ((uint32_t)trailer[3] << 24);
+        if (crc32(0, dest, chunk) != expected) {
+            printf("crc\n");
+            continue;
+        }
+
+        received += chunk;
+        OK();
+    }
+}
+
+uint8_t *stream_slot(uint index) { return stream.base + (index % stream.slots) * stream.record; }
+
+void stream_load(bool hwstart) {
+    // Streams records through the edit bank while core1 plays them. Records
+    // are laid out like table instructions followed by their wait when
+    // timing is on. Chunks use the same framing as bulk_load and have to be
+    // whole records, the responses are:
+    //   "ok"  - chunk was good and has been queued
+    //   "crc" - checksum did not match, resend the same chunk
+    // A zero length chunk ends the stream and core1 plays out what is queued.
+    // Any other reply also ends it, the host must stop sending chunks then
+    // as whatever follows is read as commands.
+    uint step = INS_SIZE * ad9959.channels + 1;
+    uint8_t header[BULK_HEADER];
+    uint8_t trailer[BULK_TRAILER];
+
+    save_layout();
+    stream.base = table;
+    stream.record = step + (timing ? 4 : 0);
+    stream.slots = bank_size / stream.record;
+    stream.head = stream.tail = 0;
+    stream.primed = stream.done = false;
+    stream.underruns = 0;
+
+    multicore_fifo_push_blocking(edit_bank << START_BANK_SHIFT | START_STREAM |
+                                 (hwstart ? START_HW : 0));
+    while (get_status() == STOPPED) {
+        tight_loop_contents();
+    }
+
+    printf("ready\n");
+    while (true) {
+        read_bytes(header, BULK_HEADER);
+        uint chunk = header[0] | (header[1] << 8);
+        uint records = chunk / stream.record;
+
+        if (chunk == 0) {
+            break;
+        }
+        if (chunk % stream.record || records > stream.slots / 2) {
+            printf("Invalid Chunk - must be whole %u byte records, at most %u of them\n",
+                   stream.record, stream.slots / 2);
+            break;
+        }
+
+        // wait for core1 to free up enough slots, if it stops this chunk is
+        // read and dropped and the stream ends
+        while (stream.slots - (stream.head - stream.tail) < records &&
+               get_status() == RUNNING) {
+            tight_loop_contents();
+        }
+
+        // records are only published once the crc is good, so they can be
+        // read straight into the ring
+        uint32_t crc = 0;
+        for (uint i = 0; i < records; i++) {
+            uint8_t *dest = stream_slot(stream.head + i);
+            read_bytes(dest, stream.record);
+            crc = crc32(crc, dest, stream.record);
+        }
+        read_bytes(trailer, BULK_TRAILER);
+
+        uint32_t expected = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) |
+                            ((uint32_t)trailer[3] << 24);
+        if (crc != expected) {
+            printf("crc\n");
+            continue;
+        }
+        if (get_status() != RUNNING) {
+            printf("Stream stopped after %u records\n", stream.tail);
+            break;
+        }
+
+        __dmb();
+        stream.head += records;
+        if (stream.head - stream.tail >= stream.slots / 2) stream.primed = true;
+        OK();
+    }
+
+    stream.done = true;
+    stream.primed = true;
+}
+
 void update() { pio_sm_put(PIO_TRIG, 0, UPDATE); }
 
+void set_profile_pin(uint channel, bool high) {
+    // the trigger program drives the profile pins during a run, this is only
+    // for when it is idle
+    uint32_t mask = 1u << (P0 - channel);
+    pio_sm_set_pins_with_mask(PIO_TRIG, 0, high ? mask : 0, mask);
+}
+
+void ramp(uint channel, int kind, double start, double end, double delta, uint rate) {
+    // runs a linear sweep on one channel with the AD9959 doing the stepping.
+    // The whole sweep goes out as one frame, IO_UPDATE loads it with the
+    // profile pin on the starting side and flipping the pin sets it off, one
+    // step of delta every rate sync clocks (4 system clocks).
+    uint8_t frame[32];
+    uint8_t *ins = put_csr(frame, 1u << channel);
+    ins = put_sweep(&ad9959, ins, kind, start, end, delta, rate);
+
+    bool up = end >= start;
+    set_profile_pin(channel, !up);
+    serial_write(frame, ins - frame);
+    update();
+
+    // let the IO_UPDATE pulse finish before taking the pins off the program
+    while (!pio_sm_is_tx_fifo_empty(PIO_TRIG, 0)) tight_loop_contents();
+    busy_wait_us_32(1);
+    set_profile_pin(channel, up);
+}
+
 void sync() {
+    // SDIO_3 is only SYNC_I/O in the single bit modes, in 4-bit mode it is
+    // data and frames always go out whole
+    if (SERIAL_BITS == 4) return;
     gpio_put(PIN_SYNC, 1);
     sleep_ms(1);
     gpio_put(PIN_SYNC, 0);
@@ -249,9 +554,12 @@ void reset() {
     sleep_ms(1);
 
     sync();
-    ad9959.sweep_type = 1;
+    set_io_mode();
+    ad9959.sweep_type = SS_MODE;
     ad9959.channels = 1;
-    INS_SIZE = 14;
+    INS_SIZE = ins_sizes[SS_MODE];
+    timing = false;
+    save_layout();
 
     set_pll_mult(&ad9959, ad9959.pll_mult);
 
@@ -259,11 +567,6 @@ void reset() {
     update();
 }
 
-void wait(uint channel) {
-    pio_sm_get_blocking(PIO_TRIG, 0);
-    triggers++;
-}
-
 void abort_run() {
     if (get_status() == RUNNING) {
         set_status(ABORTING);
@@ -281,1175 +584,3113 @@ void abort_run() {
 
 
 // =============================================================================
-// Table Running Loop
+// Amplitude Calibration
 // =============================================================================
 
-void background() {
-    // let other core know ready
-    multicore_fifo_push_blocking(0);
-
-    int hwstart = 0;
-    while (true) {
-        // wait for a start command
-        hwstart = multicore_fifo_pop_blocking();
+// Amplitude flattening across the tweezer array. A natural cubic spline is
+// fitted once to the calibration points (frequency in MHz, amplitude 0-1).
+// cal_eval() evaluates it with a binary search and Horner's rule, and
+// cal_asf() reads a dense table of the spline indexed by FTW, so the lookup
+// during a sweep is a shift, two loads and a multiply.
+
+#define CAL_LUT_SIZE 512
+#define CAL_FRAC_BITS 8
+
+struct {
+    uint n;
+    float x[MAX_POINTS];
+    // spline segment i is a + b*t + c*t^2 + d*t^3 with t = x - x[i]
+    float a[MAX_POINTS], b[MAX_POINTS], c[MAX_POINTS], d[MAX_POINTS];
+
+    // amplitude in ppm at ftw_lo + (i << shift), rebuilt if the system clock
+    // changes since the FTWs depend on it
+    uint64_t sys_clk_milli;
+    uint32_t ftw_lo, ftw_hi;
+    uint shift;
+    uint32_t lut[CAL_LUT_SIZE];
+} cal;
+
+// measured on the tweezer array
+static const float cal_default_x[] = {85.5, 92.5, 99.5, 106.5, 113.5, 120.5};
+static const float cal_default_y[] = {0.681, 0.688, 0.7349, 0.710, 0.76, 0.9};
+
+static float cal_poly(uint k, float x) {
+    float t = x - cal.x[k];
+    return cal.a[k] + t * (cal.b[k] + t * (cal.c[k] + t * cal.d[k]));
+}
 
-        set_status(RUNNING);
+float cal_eval(float x) {
+    // clamp to the calibrated range
+    if (x <= cal.x[0]) return cal.a[0];
+    if (x >= cal.x[cal.n - 1]) return cal.a[cal.n - 1];
 
-        // pre-calculate spacing vars
-        uint step = INS_SIZE * ad9959.channels + 1;
-        uint offset = 0;
-
-        // count instructions to run
-        bool repeat = false;
-        int num_ins = 0;
-        int i = 0;
-        while (true) {
-            // If an instruction is empty that means to stop
-            if (instructions[offset] == 0x00) {
-                if (instructions[offset + 1]) {
-                    repeat = true;
-                }
-                break;
-            }
-            offset = step * ++i;
+    uint lo = 0, hi = cal.n - 1;
+    while (hi - lo > 1) {
+        uint mid = (lo + hi) / 2;
+        if (x < cal.x[mid]) {
+            hi = mid;
+        } else {
+            lo = mid;
         }
+    }
+    return cal_poly(lo, x);
+}
 
-        num_ins = i;
-        offset = i = 0;
-        triggers = 0;
+void cal_build_lut() {
+    uint8_t buf[4];
+    uint64_t lo_milli = cal.x[0] * 1e9;
+    uint64_t hi_milli = cal.x[cal.n - 1] * 1e9;
+    uint32_t ftw_lo = get_ftw_mhz(&ad9959, lo_milli, buf);
+    uint32_t ftw_hi = get_ftw_mhz(&ad9959, hi_milli, buf);
+
+    uint shift = 0;
+    while (((ftw_hi - ftw_lo) >> shift) >= CAL_LUT_SIZE - 1) shift++;
+
+    double sys_clk = ad9959.ref_clk * ad9959.pll_mult;
+    for (uint i = 0; i < CAL_LUT_SIZE; i++) {
+        double ftw = ftw_lo + ((double)i * (1u << shift));
+        float mhz = ftw * sys_clk / 4294967296.0 / 1e6;
+
+        // the entry past the end carries on the last segment so the top of
+        // the range interpolates properly
+        float amp = mhz < cal.x[cal.n - 1] ? cal_eval(mhz) : cal_poly(cal.n - 2, mhz);
+        cal.lut[i] = amp < 0 ? 0 : amp * 1e6 + 0.5;
+    }
 
-        // sync just to be sure
-        sync();
+    cal.ftw_lo = ftw_lo;
+    cal.ftw_hi = ftw_hi;
+    cal.shift = shift;
+    cal.sys_clk_milli = ad9959.sys_clk_milli;
+}
 
-        // if this is hwstart, stell the timer pio core and it will handle that on its own
-        if (hwstart) {
-            pio_sm_put(PIO_TIME, 0, 0);
-        }
+bool cal_fit(const float *x, const float *y, uint n) {
+    if (n < 2 || n > MAX_POINTS) return false;
+    for (uint i = 0; i < n - 1; i++) {
+        if (x[i + 1] <= x[i]) return false;
+    }
 
-        while (status != ABORTING) {
-            // check if last instruction
-            if (i == num_ins) {
-                if (repeat) {
-                    i = offset = 0;
-                } else {
-                    break;
-                }
-            }
+    float h[MAX_POINTS], alpha[MAX_POINTS], l[MAX_POINTS], mu[MAX_POINTS], z[MAX_POINTS];
 
-            // prime PIO
-            pio_sm_put(PIO_TRIG, 0, instructions[offset]);
+    for (uint i = 0; i < n - 1; i++) {
+        h[i] = x[i + 1] - x[i];
+    }
+    for (uint i = 1; i < n - 1; i++) {
+        alpha[i] = 3.0f / h[i] * (y[i + 1] - y[i]) - 3.0f / h[i - 1] * (y[i] - y[i - 1]);
+    }
 
-            // send new instruciton to AD9959
-            spi_write_blocking(spi1, instructions + offset + 1, step - 1);
+    // tridiagonal solve with natural end conditions
+    l[0] = 1.0f;
+    mu[0] = 0.0f;
+    z[0] = 0.0f;
+    for (uint i = 1; i < n - 1; i++) {
+        l[i] = 2.0f * (x[i + 1] - x[i - 1]) - h[i - 1] * mu[i - 1];
+        mu[i] = h[i] / l[i];
+        z[i] = (alpha[i] - h[i - 1] * z[i - 1]) / l[i];
+    }
 
-            // if on the first instruction, begin the timer
-            if (i == 0 && timing) {
-                dma_channel_transfer_from_buffer_now(timer_dma, instructions + TIMING_OFFSET,
-                                                     num_ins);
-            }
+    cal.n = n;
+    cal.c[n - 1] = 0.0f;
+    cal.b[n - 1] = cal.d[n - 1] = 0.0f;
+    for (int j = n - 2; j >= 0; j--) {
+        cal.c[j] = z[j] - mu[j] * cal.c[j + 1];
+        cal.b[j] = (y[j + 1] - y[j]) / h[j] - h[j] * (cal.c[j + 1] + 2.0f * cal.c[j]) / 3.0f;
+        cal.d[j] = (cal.c[j + 1] - cal.c[j]) / (3.0f * h[j]);
+    }
+    for (uint i = 0; i < n; i++) {
+        cal.x[i] = x[i];
+        cal.a[i] = y[i];
+    }
 
-            wait(0);
+    cal_build_lut();
+    return true;
+}
 
-            offset = step * ++i;
-        }
+uint32_t cal_asf(uint32_t ftw) {
+    // amplitude in ppm for a tuning word, linear between table entries
+    if (cal.sys_clk_milli != ad9959.sys_clk_milli) cal_build_lut();
 
-        // clean up
-        dma_channel_abort(timer_dma);
-        pio_sm_clear_fifos(PIO_TRIG, 0);
-        pio_sm_clear_fifos(PIO_TIME, 0);
-        set_status(STOPPED);
-    }
+    if (ftw <= cal.ftw_lo) return cal.lut[0];
+    if (ftw > cal.ftw_hi) ftw = cal.ftw_hi;
+    uint32_t offset = ftw - cal.ftw_lo;
+    uint i = offset >> cal.shift;
+
+    uint32_t frac = offset & ((1u << cal.shift) - 1);
+    frac = cal.shift > CAL_FRAC_BITS ? frac >> (cal.shift - CAL_FRAC_BITS)
+                                     : frac << (CAL_FRAC_BITS - cal.shift);
+    int32_t step = (int32_t)cal.lut[i + 1] - (int32_t)cal.lut[i];
+    return cal.lut[i] + ((step * (int32_t)frac) >> CAL_FRAC_BITS);
 }
 
 // =============================================================================
-// Serial Communication Loop
+// Packed Tables
 // =============================================================================
 
-void loop() {
-    readline();
-    int local_status = get_status();
+// Tweezer tables use the same few tuning words over and over, so a bank can
+// hold its table packed: a palette of channel instructions at the start of
+// the bank, then records of a trigger byte and one palette index per
+// channel. A two channel single step table takes 3 bytes a step instead of
+// 29. Control records keep their zero trigger byte and index an entry that
+// holds the op and its argument. Waits stay in the timing table.
+//
+// run_table() unpacks each record into a frame buffer while the step before
+// it waits for its trigger. Editing goes through a raw copy of one record,
+// ins_ptr() unpacks it and pack_record() finds its blocks in the palette.
+#define PALETTE_MAX 256
+
+// the record being edited in a packed or sparse bank, or -1
+struct {
+    int addr;
+    uint8_t raw[MAX_RECORD];
+} editing = {.addr = -1};
+
+uint record_size(const table_bank *layout) {
+    // for a sparse table the shortest a record can be
+    if (layout->sparse) return 2;
+    if (layout->palette_size) return layout->channels + 1;
+    return layout->ins_size * layout->channels + 1;
+}
 
-    if (strncmp(readstring, "version", 7) == 0) {
-        printf("%s\n", VERSION);
-    } else if (strncmp(readstring, "status", 6) == 0) {
-        printf("%d\n", local_status);
-    } else if (strncmp(readstring, "debug on", 8) == 0) {
-        DEBUG = 1;
-        OK();
-    } else if (strncmp(readstring, "debug off", 9) == 0) {
-        DEBUG = 0;
-        OK();
-    } else if (strncmp(readstring, "getfreqs", 8) == 0) {
-        measure_freqs();
-    } else if (strncmp(readstring, "numtriggers", 11) == 0) {
-        printf("%u\n", triggers);
-    } else if (strncmp(readstring, "reset", 5) == 0) {
-        abort_run();
-        reset();
-        set_status(STOPPED);
-        OK();
-    } else if (strncmp(readstring, "abort", 5) == 0) {
-        abort_run();
-        OK();
+uint records_offset(const table_bank *layout) {
+    if (layout->sparse) return SPARSE_HEADER;
+    return layout->palette_size * layout->ins_size;
+}
+
+void unpack(const uint8_t *palette, uint ins_size, const uint8_t *rec, uint size, uint8_t *raw) {
+    // size is that of the packed record, raw gets the record it stands for
+    raw[0] = rec[0];
+    if (rec[0] == 0x00) {
+        memcpy(raw + 1, palette + rec[1] * ins_size, CTRL_SIZE);
+        return;
     }
-    // ====================================================
-    // Stuff that cannot be done while the table is running
-    // ====================================================
-    else if (local_status != STOPPED) {
-        printf(
-            "Cannot execute command \"%s\" during buffered execution. Check "
-            "status first and wait for it to return %d (stopped or aborted).\n",
-            readstring, STOPPED);
-    } else if (strncmp(readstring, "readregs", 8) == 0) {
-        single_step_mode();
-        update();
-        read_all();
-        OK();
-      }  else if (strncmp(readstring, "load", 4) == 0) {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wstringop-overread"
-        memcpy(instructions, ((uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET)), MAX_SIZE);
-#pragma GCC diagnostic pop
+    for (uint c = 0; c < size - 1; c++) {
+        memcpy(raw + 1 + c * ins_size, palette + rec[c + 1] * ins_size, ins_size);
+    }
+}
 
-        OK();
-    } else if (strncmp(readstring, "save", 4) == 0) {
-        uint32_t ints = save_and_disable_interrupts();
-        // erase sections
-        flash_range_erase(FLASH_TARGET_OFFSET, MAX_SIZE);
-        // reprogram
-        flash_range_program(FLASH_TARGET_OFFSET, instructions, MAX_SIZE);
-        restore_interrupts(ints);
-        OK();
-    } else if (strncmp(readstring, "setfreq1", 8) == 0) {
-        // setfreq <channel:int> <frequency:float>
+uint table_end(const table_bank *layout, const uint8_t *base, uint limit) {
+    // the end record of the table at base, or limit if it has none before that
+    uint size = record_size(layout);
+    if (layout->sparse) {
+        // the header says, once the table has been ended and has its index
+        const sparse_header *h = (const sparse_header *)base;
+        bool ended = h->index_at >= SPARSE_HEADER && h->records > 0 && h->records <= limit &&
+                     h->index_at + h->records * 4 <= SPARSE_HEADER + limit * size;
+        return ended ? h->records - 1 : limit;
+    }
+    const uint8_t *records = base + records_offset(layout);
+    for (uint i = 0; i < limit; i++) {
+        // If an instruction is empty that means to stop, unless it is a
+        // control record that runs in place
+        const uint8_t *ins = records + size * i;
+        if (ins[0] != 0x00) continue;
+        uint8_t op = layout->palette_size ? base[ins[1] * layout->ins_size] : ins[1];
+        if (op <= CTRL_REPEAT) return i;
+    }
+    return limit;
+}
 
-        uint channel=0;
-        double freq=85500000;
-        uint8_t ftw[4];
-        freq = get_ftw(&ad9959, freq, ftw);
-        send_channel(0x04, channel, ftw, 4);
-        update();
+uint8_t *packed_record(uint addr) {
+    return table + palette_size * INS_SIZE + addr * (ad9959.channels + 1);
+}
 
-        if (DEBUG) {
-             printf("set freq: %lf\n", freq);
-        }
-        OK();
-    } else if (strncmp(readstring, "setfreq2", 8) == 0) {
-        // setfreq <channel:int> <frequency:float>
+uint8_t *edit_record(uint addr) {
+    if (editing.addr != (int)addr) {
+        unpack(table, INS_SIZE, packed_record(addr), ad9959.channels + 1, editing.raw);
+        editing.addr = addr;
+    }
+    return editing.raw;
+}
 
-        uint channel=0;
-        double freq=120500000;
-        uint8_t ftw[4];
-        freq = get_ftw(&ad9959, freq, ftw);
-        send_channel(0x04, channel, ftw, 4);
-        update();
+bool palette_index(const uint8_t *block, uint8_t *index) {
+    // points index at an entry holding block, adding one if there is none
+    if (*index < palette_used && memcmp(table + *index * INS_SIZE, block, INS_SIZE) == 0) {
+        return true;
+    }
+    uint i = 0;
+    while (i < palette_used && memcmp(table + i * INS_SIZE, block, INS_SIZE) != 0) i++;
+    if (i == palette_size) return false;
+    if (i == palette_used) {
+        memcpy(table + i * INS_SIZE, block, INS_SIZE);
+        palette_used++;
+    }
+    *index = i;
+    return true;
+}
 
-        if (DEBUG) {
-             printf("set freq: %lf\n", freq);
-        }
-        OK();
-    } else if (strncmp(readstring, "setamp", 6) == 0) {
-        // setamp <channel:int> <amp:float>
-        uint channel=0;
-        double amp=0.681;
-        uint8_t asf[3];
-        amp = get_asf(amp, asf);
-        send_channel(0x06, channel, asf, 3);
-        update();
-        if (DEBUG) {
-            printf("Amp: %12lf\n", amp);
-        }
-        OK();
-    } else if (strncmp(readstring, "checkv", 11) == 0) {
-        // setfreq <channel:int> <frequency:float>
-
-        uint channel=0;
-        double freq1=92.5*1000000;
-        double freq2=99.5*1000000;
-        uint8_t ftw1[4];
-        uint8_t ftw2[4];
-        int j=1;
-        double amp1=0.49955;
-        double amp2=0.49955;
-        uint8_t asf1[3];
-        uint8_t asf2[3];
-        
-        while(j<=30000){
-          amp1 = get_asf(0.685, asf1);
-          send_channel(0x06, channel, asf1, 3);
-          update();
-          freq1 = get_ftw(&ad9959, freq1, ftw1);
-          send_channel(0x04, channel, ftw1, 4);
-          update();
-          sleep_ms(1000);
-          freq2 = get_ftw(&ad9959, freq2, ftw2);
-          send_channel(0x04, channel, ftw2, 4);
-          update();
-          amp2 = get_asf(0.716, asf2);
-          send_channel(0x06, channel, asf2, 3);
-          update();
-          
-          j++;
-          sleep_ms(2000);
-        }j=1;
-        amp2 = get_asf(0, asf2);
-        send_channel(0x06, channel, asf2, 3);
-        update();
-      } else if (strncmp(readstring, "Custom", 6) == 0) {
-        // setfreq <channel:int> <frequency:float>
+bool pack_record(uint addr) {
+    // puts the record being edited back, false if the palette ran out.
+    // Raw tables are edited in place and have nothing to do.
+    if (!palette_size) return true;
+    uint8_t *rec = packed_record(addr);
+    editing.addr = -1;
+
+    // the trigger byte goes in last, so a record that did not fit does not
+    // turn into a control record
+    if (editing.raw[0] == 0x00) {
+        uint8_t entry[MAX_RECORD] = {0};
+        memcpy(entry, editing.raw + 1, CTRL_SIZE);
+        if (!palette_index(entry, rec + 1)) return false;
+    }
+    for (uint c = 0; editing.raw[0] != 0x00 && c < ad9959.channels; c++) {
+        // a channel that has not been set yet has no CSR and keeps its index
+        const uint8_t *block = editing.raw + 1 + c * INS_SIZE;
+        if (block[1] == 0x00) continue;
+        if (!palette_index(block, rec + 1 + c)) return false;
+    }
+    rec[0] = editing.raw[0];
+    return true;
+}
 
-        uint channel=0;
-        double freq;
-        uint8_t ftw[4];
-        int i=0;
-        double amp=0.55;
-        uint8_t asf[3];
-        amp = get_asf(amp, asf);
-        send_channel(0x06, channel, asf, 3);
-        update();
-        int j=1;
-        while(j<=30000){
-        while(i<=5){    
-          if(i%6==0){
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 85500000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          //sleep_ms(1);
-          }
-          else if(i%6==1){
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92500000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();}
-          else if(i%6==2){
-          freq = get_ftw(&ad9959, 99500000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();}
-          else if(i%6==3){
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106500000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();}
-          else if(i%6==4){
-          freq = get_ftw(&ad9959, 113500000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          }else{
-          freq = get_ftw(&ad9959, 120500000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.89, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          
-          }
-          sleep_ms(1);
-          amp = get_asf(0.0, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 0.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          i++;
-          
-          //printf("Frequency in MHz:",i);
-        }i=0;j++;}
-      } else if (strncmp(readstring, "sweepamp", 11) == 0) {
-        // setfreq <channel:int> <frequency:float>
-
-        uint channel=0;
-        double freq=85.5*1000000;
-        uint8_t ftw[4];
-        int j=1;
-        double amp=0.65;
-        double temp=amp;
-        uint8_t asf[3];
-        amp = get_asf(amp, asf);
-        send_channel(0x06, channel, asf, 3);
-        update();
-        freq = get_ftw(&ad9959, freq, ftw);
-        send_channel(0x04, channel, ftw, 4);
-        update();
-        while(j<1000){
-        int i=1;
-        while(i<=50){
-            amp=temp+i*0.001;
-            amp = get_asf(amp, asf);
-            send_channel(0x06, channel, asf, 3);
-            update();
-            i++;
-            sleep_ms(1.5);
-        }
-        j++;
-        }
-        send_channel(0x06, channel, 0, 3);
-        update();
-      } else if (strncmp(readstring, "freq99.5", 8) == 0) {
-        // setfreq <channel:int> <frequency:float>
-        double amp=1.0;
-        double freq=99500000;
-        uint8_t ftw[4];
-        uint8_t asf[3];
-        amp = get_asf(amp, asf);
-        send_channel(0x06, 0, asf, 3);
-        update();
-        amp = get_asf(amp, asf);
-        send_channel(0x06, 1, asf, 3);
-        update();
-        freq = get_ftw(&ad9959, freq, ftw);
-        send_channel(0x04, 0, ftw, 4);
-        update();
-        freq = get_ftw(&ad9959, freq, ftw);
-        send_channel(0x04, 1, ftw, 4);
-        update();
+// =============================================================================
+// Sparse Tables
+// =============================================================================
 
+// Raw and packed records are a fixed stride apart and every step sends a
+// block for every channel. A sparse bank holds variable length records
+// instead: a step is its trigger byte, the length of its frame and only the
+// channel blocks it changes, so a step that moves one tweezer of four sends
+// one block. In single step mode set also leaves out the registers given as
+// negative values. The AD9959 keeps what it was last sent, so whatever a
+// step leaves out is what the steps played before it set. Control records
+// are the same as in a raw table.
+//
+// Records are written in order, each after the last, and the record that
+// ends the table puts an index of where every record starts after them so
+// jumps and loops can find their target. Waits stay in the timing table.
+
+sparse_header *sparse_table() { return (sparse_header *)table; }
+
+void sparse_clear() {
+    // starts the bank being edited over as an empty sparse table
+    memset(table, 0, SPARSE_HEADER);
+}
 
-        if (DEBUG) {
-             printf("set freq: %lf\n", freq);
-        }
-        OK();
-    } else if (strncmp(readstring, "Interpolate", 11) == 0) {
-        // setfreq <channel:int> <frequency:float>
-        float x[MAX_POINTS] ={85.5, 92.5, 99.5, 106.5, 113.5, 120.5};
-        float y[MAX_POINTS] = {0.681, 0.688, 0.7349, 0.710, 0.76, 0.9};//0.898
-        // Number of data points
-        int n = sizeof(x) / sizeof(x[0]);
-        uint channel=0;
-        double freq;
-        uint8_t ftw[4];
-        int j=0;
-        double resultX;
-        double amp=0.5;
-        uint8_t asf[3];
-        amp = get_asf(amp, asf);
-        send_channel(0x06, channel, asf, 3);
-        update();
-        while(j<=200){
-        int i=85;
-        while(i<=120){    
-          freq=(i+0.5)*1000000.0;
-          resultX=i+0.5;
-          amp=cubicSplineInterpolation(x, y, n, resultX);
-          
-          printf("set amp: %.2f\n", amp);
-          amp = get_asf(amp, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, freq, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-            //OK();
-            sleep_ms(3);
-            i++;
-          //printf("Frequency in MHz:",i);
-        }j++;
-        amp = get_asf(0, asf);
-        send_channel(0x06, channel, asf, 3);
-        update();
-        sleep_ms(1);}
-      } else if (strncmp(readstring, "freq_and_amp", 12) == 0) {
-        // setfreq <channel:int> <frequency:float>
+uint sparse_record_size(const uint8_t *rec) {
+    return rec[0] == 0x00 ? 1 + CTRL_SIZE : 2 + rec[1];
+}
 
-        uint channel=0;
-        double freq;
-        uint8_t ftw[4];
-        int i=85; 
-        int j=0;
-        double amp=1.0;
-        uint8_t asf[3];
-        amp = get_asf(amp, asf);
-        send_channel(0x06, channel, asf, 3);
-        update();
-        printf("set amp: %.2f\n", amp);
-        while(j<500){
-        while(i<=121){    
-          freq=(i+0.5)*1000000.0;
-          freq = get_ftw(&ad9959, freq, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          //OK();
-          sleep_ms(2);
-          printf("Frequency in MHz:%2f\n",(i+0.5));
-          i++;
-        }
-        i=85;
-        j++;
-      }
-    } else if (strncmp(readstring, "Cust", 4) == 0) {
-        // setfreq <channel:int> <frequency:float>
-
-        uint channel=0;
-        double freq;
-        uint8_t ftw[4];
-        int i=0;
-        double amp=0.55;
-        uint8_t asf[3];
-        amp = get_asf(amp, asf);
-        send_channel(0x06, channel, asf, 3);
-        update();
-        int j=1;
-        while(j<=30000){
-        while(i<=5){    
-          if(i%6==0){
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 85500000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          //sleep_ms(1);
-          }
-          else if(i%6==1){
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92500000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();}
-          else if(i%6==3){
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106500000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();}
-          else if(i%6==5){
-          freq = get_ftw(&ad9959, 120500000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.89, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          }
-          sleep_ms(1);
-          amp = get_asf(0.0, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 0.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          i++;
-          
-          //printf("Frequency in MHz:",i);
-        }i=0;j++;}
-    }
-    else if (strncmp(readstring, "pattern1", 8) == 0) {// 2 diagnol points
-        // setfreq <channel:int> <frequency:float>
-
-        uint channel=0;
-        uint channel1=1;
-        double freq;
-        uint8_t ftw[4];
-        int i=0; 
-        double amp;
-        uint8_t asf[3];
-        while(i<=10000){
-          i++;
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 85.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(1.0, asf);
-          send_channel(0x06, channel1, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 86*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 113.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 114*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          amp = get_asf(1.0, asf);
-          send_channel(0x06, channel1, asf, 3);
-          update();
-          sleep_ms(1);
-        
-        }
-    } else if (strncmp(readstring, "pattern2", 8) == 0) {
-        // setfreq <channel:int> <frequency:float>
-        
-        uint channel=0;
-        uint channel1=1;
-        double freq;
-        uint8_t ftw[4];
-        int i=0; 
-        double amp;
-        uint8_t asf[3];
-        amp = get_asf(1.0, asf);
-        send_channel(0x06, channel1, asf, 3);
-        update();//Channel 1 always set to 1.0
-        while(i<=10000){
-          i++;
-          freq = get_ftw(&ad9959, 86*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 113.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 86*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 93*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 100*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 107*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 114*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 85.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 107*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 100*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 93*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);        
-        }
-    } else if (strncmp(readstring, "pattern3", 8) == 0) {
-        // setfreq <channel:int> <frequency:float>
+bool sparse_in_order(uint addr) {
+    // the last record can be set again, or the one after it
+    const sparse_header *h = sparse_table();
+    return addr == h->records || addr + 1 == h->records;
+}
 
-        uint channel=0;
-        uint channel1=1;
-        double freq;
-        uint8_t ftw[4];
-        int i=0; 
-        double amp;
-        uint8_t asf[3];
-        amp = get_asf(1.0, asf);
-        send_channel(0x06, channel1, asf, 3);
-        update();
-        while(i<=10000){
-          i++;
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 85.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          freq = get_ftw(&ad9959, 86*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 113.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          sleep_ms(1);
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          freq = get_ftw(&ad9959, 93*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 100*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 107*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 114*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);
-        }
-    } else if (strncmp(readstring, "pattern4", 8) == 0) {
+uint8_t *sparse_edit(uint addr) {
+    // only the trigger byte carries over, the setters fill in their block
+    if (editing.addr != (int)addr) {
+        const sparse_header *h = sparse_table();
+        memset(editing.raw, 0, sizeof editing.raw);
+        if (addr + 1 == h->records) editing.raw[0] = table[SPARSE_HEADER + h->last];
+        editing.addr = addr;
+    }
+    return editing.raw;
+}
 
-        uint channel=0;
-        uint channel1=1;
-        double freq;
-        uint8_t ftw[4];
-        int i=0; 
-        double amp;
-        uint8_t asf[3];
-        amp = get_asf(1.0, asf);
-        send_channel(0x06, channel1, asf, 3);
-        update();
-        while(i<=10000){
-          i++;
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          freq = get_ftw(&ad9959, 114*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 107*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 100*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          freq = get_ftw(&ad9959, 85.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 113.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 93*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          freq = get_ftw(&ad9959, 85.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 113.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 86*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          sleep_ms(1);
-        
+uint sparse_block(const uint8_t *rec, uint channel, uint8_t *out) {
+    // copies the block a step has for channel to out and returns its length.
+    // A block is the CSR write that selects the channel, then registers up
+    // to the next CSR write.
+    if (!rec || rec[0] == 0x00) return 0;
+    const uint8_t *frame = rec + 2;
+    uint at = 0;
+    while (at < rec[1]) {
+        uint start = at;
+        uint8_t csr = frame[at + 1];
+        at += 2;
+        while (at < rec[1] && frame[at] != 0x00) at += 1 + reg_size(frame[at]);
+        if (csr & (1u << (channel + 4))) {
+            memcpy(out, frame + start, at - start);
+            return at - start;
         }
-    } else if (strncmp(readstring, "pattern5", 8) == 0) {
-        // setfreq <channel:int> <frequency:float>
-        
-        uint channel=0;
-        uint channel1=1;
-        double freq;
-        uint8_t ftw[4];
-        int i=0; 
-        double amp;
-        uint8_t asf[3];
-        amp = get_asf(1.0, asf);
-        send_channel(0x06, channel1, asf, 3);
-        update();//Channel 1 always set to 1.0
-        while(i<=10000){
-          i++;
-          freq = get_ftw(&ad9959, 86*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 113.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          freq = get_ftw(&ad9959, 93*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 100*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 107*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          freq = get_ftw(&ad9959, 114*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 107*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          freq = get_ftw(&ad9959, 85.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 100*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 93*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 107*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-        }
-    } else if (strncmp(readstring, "pattern6", 8) == 0) {
-        // setfreq <channel:int> <frequency:float>
-        
-        uint channel=0;
-        uint channel1=1;
-        double freq;
-        uint8_t ftw[4];
-        int i=0; 
-        double amp;
-        uint8_t asf[3];
-        amp = get_asf(1.0, asf);
-        send_channel(0x06, channel1, asf, 3);
-        update();//Channel 1 always set to 1.0
-        while(i<=10000){
-          i++;
-          freq = get_ftw(&ad9959, 86*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 113.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 85.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next--------------------------
-          freq = get_ftw(&ad9959, 100*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 113.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 85.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next 
-          freq = get_ftw(&ad9959, 114*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 107*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 92*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          sleep_ms(1);
-        }
-    } else if (strncmp(readstring, "pattern7", 8) == 0) {
-        // setfreq <channel:int> <frequency:float>
-        
-        uint channel=0;
-        uint channel1=1;
-        double freq;
-        uint8_t ftw[4];
-        int i=0; 
-        double amp;
-        uint8_t asf[3];
-        amp = get_asf(1.0, asf);
-        send_channel(0x06, channel1, asf, 3);
-        update();//Channel 1 always set to 1.0
-        while(i<=10000){
-          i++;
-          freq = get_ftw(&ad9959, 86*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 85.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 113.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 93*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 100*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          amp = get_asf(0.717, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 99.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          freq = get_ftw(&ad9959, 107*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          amp = get_asf(0.685, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 92.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.703, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 106.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
-          freq = get_ftw(&ad9959, 114*1000000.0, ftw);
-          send_channel(0x04, channel1, ftw, 4);
-          update();
-          amp = get_asf(0.681, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 85.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);//Next
-          amp = get_asf(0.755, asf);
-          send_channel(0x06, channel, asf, 3);
-          update();
-          freq = get_ftw(&ad9959, 113.5*1000000.0, ftw);
-          send_channel(0x04, channel, ftw, 4);
-          update();
-          sleep_ms(1);
+    }
+    return 0;
+}
+
+bool sparse_store(uint addr, int channel, uint len) {
+    // puts the record being edited in, with len bytes of block for channel
+    // in place of the one it had, or as a control record for channel -1.
+    // False if there is no room for it, the end record and the index.
+    sparse_header *h = sparse_table();
+    uint8_t *records = table + SPARSE_HEADER;
+    const uint8_t *old = addr < h->records ? records + h->last : NULL;
+    uint at = old ? h->last : h->used;
+    editing.addr = -1;
+
+    uint8_t rec[MAX_RECORD + 1];
+    uint size = 1 + CTRL_SIZE;
+    if (channel < 0) {
+        memcpy(rec, editing.raw, size);
+    } else {
+        // the other channels keep their blocks, all of them in channel order
+        rec[0] = editing.raw[0];
+        size = 2;
+        for (uint c = 0; c < ad9959.channels; c++) {
+            if (c != (uint)channel) {
+                size += sparse_block(old, c, rec + size);
+                continue;
+            }
+            memcpy(rec + size, editing.raw + 1 + c * INS_SIZE, len);
+            size += len;
         }
+        rec[1] = size - 2;
+    }
+
+    uint space = (timing ? TIMING_OFFSET : bank_size) - SPARSE_HEADER;
+    uint index = ((at + size + 1 + CTRL_SIZE + 3) & ~3u) + (addr + 2) * 4;
+    if (index > space) return false;
+
+    memcpy(records + at, rec, size);
+    h->records = addr + 1;
+    h->used = at + size;
+    h->last = at;
+    h->index_at = 0;
+    return true;
+}
+
+void sparse_finish() {
+    // the end record is in, the index goes after it
+    sparse_header *h = sparse_table();
+    const uint8_t *records = table + SPARSE_HEADER;
+    uint32_t at = SPARSE_HEADER + ((h->used + 3) & ~3u);
+    uint32_t *index = (uint32_t *)(table + at);
+    uint32_t offset = 0;
+    for (uint i = 0; i < h->records; i++) {
+        index[i] = offset;
+        offset += sparse_record_size(records + offset);
     }
+    h->index_at = at;
 }
 
 // =============================================================================
-// Initial Setup
+// Table Programming
 // =============================================================================
 
-int main() {
-    init_pin(PICO_DEFAULT_LED_PIN);
-    gpio_put(PICO_DEFAULT_LED_PIN, 1);
+uint max_instructions() {
+    // leave room for the instruction that ends the table. Sparse records
+    // are counted at their shortest, each with its index entry.
+    uint step = palette_size ? ad9959.channels + 1 : INS_SIZE * ad9959.channels + 1;
+    uint space = (timing ? TIMING_OFFSET : bank_size) - palette_size * INS_SIZE;
+    if (sparse) {
+        step = 2 + 4;
+        space -= SPARSE_HEADER;
+    }
+    uint limit = space / step - 1;
+    if (timing && limit > TIMERS) limit = TIMERS;
+    return limit;
+}
 
-    stdio_init_all();
+uint8_t *ins_ptr(uint addr, uint channel) {
+    if (sparse) return sparse_edit(addr) + 1 + channel * INS_SIZE;
+    if (palette_size) return edit_record(addr) + 1 + channel * INS_SIZE;
+    uint step = INS_SIZE * ad9959.channels + 1;
+    return table + addr * step + 1 + channel * INS_SIZE;
+}
 
-    set_sys_clock_khz(125 * MHZ / 1000, false);
+void set_time(uint addr, uint32_t time) {
+    uint32_t *waits = (uint32_t *)(table + TIMING_OFFSET);
+    waits[addr] = time - TIMER_OVERHEAD;
+}
 
-    // output sys clock on a gpio pin to be used as REF_CLK for AD9959
-    clock_gpio_init(PIN_CLOCK, CLOCKS_CLK_GPOUT0_CTRL_AUXSRC_VALUE_CLK_SYS, 1);
+void set_trigger(uint addr, uint channel, bool before, bool after) {
+    // the trigger program puts the low nibble on the profile pins while it
+    // pulses IO_UPDATE and the high nibble once it is done. P0 is the top pin.
+    uint8_t *trig = ins_ptr(addr, 0) - 1;
+    uint8_t bit = 1u << (3 - channel);
+    uint8_t used = (0xf0 >> ad9959.channels) & 0x0f;
+
+    // drop anything left over from channels this table does not use
+    *trig &= (used | (used << 4)) & ~(bit | (bit << 4));
+    if (before) *trig |= bit;
+    if (after) *trig |= bit << 4;
+}
 
-    // attatch spi to system clock so it runs at max rate
-    clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS, 125 * MHZ,
-                    125 * MHZ);
+bool store_record(uint addr, int channel, uint len) {
+    // puts the record being edited back, channel and len say which block
+    // changed and how long it is, channel is -1 for a control record
+    if (sparse) return sparse_store(addr, channel, len);
+    return pack_record(addr);
+}
 
-    // init SPI
-    spi_init(spi1, 100 * MHZ);
-    spi_set_format(spi1, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
-    gpio_set_function(PIN_MISO, GPIO_FUNC_SPI);
-    gpio_set_function(PIN_SCK, GPIO_FUNC_SPI);
-    gpio_set_function(PIN_MOSI, GPIO_FUNC_SPI);
+// the setters return false when a packed table has no room left in its
+// palette, or a sparse one in its bank
 
-    // launch other core
-    multicore_launch_core1(background);
-    multicore_fifo_pop_blocking();
+bool set_control(uint addr, uint8_t op, uint32_t arg, uint32_t count) {
+    uint8_t *ins = ins_ptr(addr, 0) - 1;
+    ins[0] = 0x00;
+    ins[1] = op;
+    memcpy(ins + 2, &arg, 4);
+    memcpy(ins + 6, &count, 4);
+    return store_record(addr, -1, 1 + CTRL_SIZE);
+}
 
-    // initialise the status mutex
-    mutex_init(&status_mutex);
-    mutex_init(&wait_mutex);
+bool set_end(uint addr, bool repeat, uint32_t repeats) {
+    // repeats is the total number of passes, 0 repeats until aborted
+    if (!set_control(addr, repeat ? CTRL_REPEAT : CTRL_STOP, repeats, 0)) return false;
+    if (sparse) sparse_finish();
+    return true;
+}
+
+bool set_single_step(uint addr, uint channel, double freq, double amp, double phase) {
+    uint8_t *block = ins_ptr(addr, channel);
+    uint8_t *ins = block;
+
+    // a sparse table leaves out the registers given as negative
+    *ins++ = 0x00;
+    *ins++ = CSR_MODE | (1u << (channel + 4));
+    if (!sparse || freq >= 0) ins = put_ss_reg(&ad9959, ins, 1, freq);
+    if (!sparse || phase >= 0) ins = put_ss_reg(&ad9959, ins, 2, phase);
+    if (!sparse || amp >= 0) ins = put_ss_reg(&ad9959, ins, 0, amp);
+
+    *(ins_ptr(addr, 0) - 1) = SS_TRIGGER;
+    return store_record(addr, channel, ins - block);
+}
+
+bool set_sweep(uint addr, uint channel, double start, double end, double delta, uint rate,
+               double ss1, double ss2) {
+    // descending sweeps are played by dropping the profile pin, see put_sweep
+    int kind = (ad9959.sweep_type - 1) % 3;
+    bool up = end >= start;
+
+    uint8_t *block = ins_ptr(addr, channel);
+    uint8_t *ins = block;
+    *ins++ = 0x00;
+    *ins++ = CSR_MODE | (1u << (channel + 4));
+    ins = put_sweep(&ad9959, ins, kind, start, end, delta, rate);
+
+    // modes 4-6 single step the other two parameters
+    if (ad9959.sweep_type > PHASE_MODE) {
+        static const int others[3][2] = {{1, 2}, {0, 2}, {0, 1}};
+        ins = put_ss_reg(&ad9959, ins, others[kind][0], ss1);
+        ins = put_ss_reg(&ad9959, ins, others[kind][1], ss2);
+    }
+
+    set_trigger(addr, channel, !up, up);
+    return store_record(addr, channel, ins - block);
+}
+
+// names for table addresses, jump, loop and call targets can be given as one
+#define MAX_LABELS 16
+#define LABEL_NAME 8
+
+struct {
+    char name[LABEL_NAME];
+    uint addr;
+} labels[MAX_LABELS];
+uint num_labels = 0;
+
+int find_label(const char *name) {
+    for (uint i = 0; i < num_labels; i++) {
+        if (strcmp(labels[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+bool set_label(const char *name, uint addr) {
+    // moves the label if there is one with that name already
+    int i = find_label(name);
+    if (i < 0) {
+        if (num_labels == MAX_LABELS) return false;
+        i = num_labels++;
+        strncpy(labels[i].name, name, LABEL_NAME - 1);
+        labels[i].name[LABEL_NAME - 1] = '\0';
+    }
+    labels[i].addr = addr;
+    return true;
+}
+
+// =============================================================================
+// Tweezer Sites
+// =============================================================================
+
+// Named tweezer sites and their flattened amplitudes, in integer tuning units
+// (mHz and ppm of full scale). Each site keeps its FTW and ASF bytes ready to
+// copy into a frame. Like the calibration table they are only worked out
+// again when the system clock changes, which only set_pll_mult and
+// set_ref_clk do.
+#define FREQ(mhz) ((uint64_t)((mhz) * 1e9))
+#define AMP(a) ((uint32_t)((a) * 1e6 + 0.5))
+
+#define MAX_SITES 16
+#define SITE_NAME 8
+
+typedef struct tweezer_site {
+    char name[SITE_NAME];
+    uint64_t freq;  // mHz
+    uint32_t amp;   // ppm
+    uint8_t ftw[4];
+    uint8_t asf[3];
+} tweezer_site;
+
+struct {
+    tweezer_site list[MAX_SITES];
+    uint count;
+    // system clock the tuning words were worked out for
+    uint64_t sys_clk_milli;
+} sites = {
+    .list = {
+        {.name = "s0", .freq = FREQ(85.5), .amp = AMP(0.681)},
+        {.name = "s1", .freq = FREQ(92.5), .amp = AMP(0.685)},
+        {.name = "s2", .freq = FREQ(99.5), .amp = AMP(0.717)},
+        {.name = "s3", .freq = FREQ(106.5), .amp = AMP(0.703)},
+        {.name = "s4", .freq = FREQ(113.5), .amp = AMP(0.755)},
+        {.name = "s5", .freq = FREQ(120.5), .amp = AMP(0.89)},
+    },
+    .count = 6,
+};
+
+const tweezer_site *get_site(uint i) {
+    if (sites.sys_clk_milli != ad9959.sys_clk_milli) {
+        for (uint j = 0; j < sites.count; j++) {
+            get_ftw_mhz(&ad9959, sites.list[j].freq, sites.list[j].ftw);
+            get_asf_ppm(sites.list[j].amp, sites.list[j].asf);
+        }
+        sites.sys_clk_milli = ad9959.sys_clk_milli;
+    }
+    return &sites.list[i];
+}
+
+void set_site(uint i, const char *name, uint64_t freq, uint32_t amp) {
+    // i may be one past the end to add a site
+    tweezer_site *site = &sites.list[i];
+    strncpy(site->name, name, SITE_NAME - 1);
+    site->name[SITE_NAME - 1] = '\0';
+    site->freq = freq;
+    site->amp = amp;
+    get_ftw_mhz(&ad9959, freq, site->ftw);
+    get_asf_ppm(amp, site->asf);
+    if (i == sites.count) sites.count++;
+}
+
+int find_site(const char *name) {
+    // by name, or by index
+    for (uint i = 0; i < sites.count; i++) {
+        if (strcmp(name, sites.list[i].name) == 0) return i;
+    }
+    char *end;
+    long i = strtol(name, &end, 10);
+    return *end == '\0' && end != name && i >= 0 && i < sites.count ? i : -1;
+}
+
+// =============================================================================
+// Pattern Engine
+// =============================================================================
+
+// A pattern is a list of steps that each set the frequency and amplitude of
+// one channel and then hold for a dwell time. Steps with no dwell are applied
+// together with the step after them. The tuning words are worked out once
+// while the pattern is compiled into a timed single step table, after that
+// the table runner just replays the stored SPI bytes.
+
+// steps hold integer tuning units (mHz and ppm of full scale) so compiling
+// a pattern does not need floating point. A step at a site copies the
+// site's tuning words instead, and its amplitude too with SITE_AMP.
+#define KEEP_FREQ UINT64_MAX
+#define KEEP_AMP UINT32_MAX
+#define SITE_AMP (UINT32_MAX - 1)
+#define FREQ_SITE (1ull << 63)
+#define AT_SITE(i) (FREQ_SITE | (i)), SITE_AMP
+#define CYCLES_PER_US 125
+// the longest dwell or move that still fits a wait in cycles
+#define MAX_PATTERN_US ((uint)(UINT32_MAX / CYCLES_PER_US))
+
+// shapes for moves, fractions are fixed point out of MOVE_ONE
+#define MOVE_LINEAR 0
+#define MOVE_MIN_JERK 1
+#define MOVE_COSINE 2
+#define MOVE_BITS 24
+#define MOVE_ONE ((int64_t)1 << MOVE_BITS)
+
+// offsets of the tuning words in a single step instruction
+#define SS_FTW 3
+#define SS_POW 8
+#define SS_ASF 11
+
+typedef struct pattern_step {
+    uint channel;
+    uint64_t freq;  // mHz, or KEEP_FREQ
+    uint32_t amp;   // ppm, or KEEP_AMP
+    uint dwell;   // us
+} pattern_step;
+
+typedef struct pattern_preset {
+    const char *name;
+    const pattern_step *steps;
+    size_t len;
+    uint channels;
+    uint passes;
+} pattern_preset;
+
+struct {
+    // false until patbegin sets the channel blocks up
+    bool begun;
+    uint addr;
+    bool pending;
+    uint8_t blocks[4][14];
+    // channels changed since the last step, a sparse step only has these
+    uint8_t touched;
+} pattern;
+
+void pattern_begin(uint channels) {
+    ad9959.sweep_type = SS_MODE;
+    ad9959.channels = channels;
+    INS_SIZE = ins_sizes[SS_MODE];
+    timing = true;
+    if (get_status() == STOPPED) {
+        single_step_mode();
+        update();
+    }
+
+    // every channel starts out off
+    for (uint c = 0; c < channels; c++) {
+        uint8_t *block = pattern.blocks[c];
+        block[0] = 0x00;
+        block[1] = CSR_MODE | (1u << (c + 4));
+        put_ss_reg(&ad9959, block + 2, 1, 0);
+        put_ss_reg(&ad9959, block + 7, 2, 0);
+        put_ss_reg(&ad9959, block + 10, 0, 0);
+    }
+    pattern.begun = true;
+    pattern.addr = 0;
+    pattern.pending = false;
+    pattern.touched = (1u << channels) - 1;
+    if (sparse) sparse_clear();
+}
+
+uint32_t pattern_min_time() { return WAITS_SS_BASE + WAITS_SS_PER * ad9959.channels; }
+
+bool pattern_emit(uint32_t cycles) {
+    if (pattern.addr >= max_instructions()) return false;
+    if (cycles < pattern_min_time()) cycles = pattern_min_time();
+
+    // a step that changed nothing still needs a record for its wait
+    uint touched = pattern.touched ? pattern.touched : 1;
+    for (uint c = 0; c < ad9959.channels; c++) {
+        if (sparse && !(touched & (1u << c))) continue;
+        memcpy(ins_ptr(pattern.addr, c), pattern.blocks[c], INS_SIZE);
+        *(ins_ptr(pattern.addr, 0) - 1) = SS_TRIGGER;
+        if (sparse && !sparse_store(pattern.addr, c, INS_SIZE)) return false;
+    }
+    if (!pack_record(pattern.addr)) return false;
+    set_time(pattern.addr, cycles);
+
+    pattern.addr++;
+    pattern.pending = false;
+    pattern.touched = 0;
+    return true;
+}
+
+bool pattern_flush(uint dwell) { return pattern_emit(dwell * CYCLES_PER_US); }
+
+bool pattern_add(const pattern_step *step) {
+    uint8_t *block = pattern.blocks[step->channel];
+    if (step->freq & FREQ_SITE && step->freq != KEEP_FREQ) {
+        const tweezer_site *site = get_site(step->freq & ~FREQ_SITE);
+        memcpy(block + SS_FTW, site->ftw, 4);
+        if (step->amp == SITE_AMP) memcpy(block + SS_ASF, site->asf, 3);
+    } else if (step->freq != KEEP_FREQ) {
+        get_ftw_mhz(&ad9959, step->freq, block + SS_FTW);
+    }
+    if (step->amp != KEEP_AMP && step->amp != SITE_AMP) get_asf_ppm(step->amp, block + SS_ASF);
+    pattern.pending = true;
+    pattern.touched |= 1u << step->channel;
+
+    if (step->dwell) return pattern_flush(step->dwell);
+    return true;
+}
+
+uint32_t move_shape(int profile, uint k, uint n) {
+    // fraction of the move done after k of n steps, out of MOVE_ONE
+    uint64_t u = ((uint64_t)k << MOVE_BITS) / n;
+    if (profile == MOVE_MIN_JERK) {
+        // 10u^3 - 15u^4 + 6u^5, zero velocity and acceleration at both ends
+        uint64_t u3 = ((u * u) >> MOVE_BITS) * u >> MOVE_BITS;
+        uint64_t poly = 10 * MOVE_ONE + ((6 * u * u) >> MOVE_BITS) - 15 * u;
+        return (u3 * poly) >> MOVE_BITS;
+    }
+    if (profile == MOVE_COSINE) {
+        return (1 - cos(M_PI * k / n)) / 2 * MOVE_ONE;
+    }
+    return u;
+}
+
+bool pattern_move(uint channel, uint64_t start, uint64_t end, uint duration, int profile) {
+    // glides the frequency of a channel from start to end, or from where it
+    // is with KEEP_FREQ. The move is laid down as single steps at the
+    // shortest wait the table allows and spends the same time on each, it
+    // reaches end together with the step after it. Steps are spaced in FTW,
+    // which is linear in frequency.
+    // That wait is pattern_min_time(), a few hundred cycles, so a move is a
+    // staircase at that spacing rather than a per-microsecond glide or a
+    // sweep on the AD9959, which cannot follow the shaped profiles.
+    uint8_t *ftw = pattern.blocks[channel] + SS_FTW;
+    uint32_t from = start == KEEP_FREQ
+                        ? (uint32_t)ftw[0] << 24 | ftw[1] << 16 | ftw[2] << 8 | ftw[3]
+                        : get_ftw_mhz(&ad9959, start, ftw);
+    uint32_t to = get_ftw_mhz(&ad9959, end, ftw);
+    int64_t span = (int64_t)to - from;
+
+    uint32_t total = duration * CYCLES_PER_US;
+    uint n = total / pattern_min_time();
+    if (n == 0) n = 1;
+
+    for (uint k = 0; k < n; k++) {
+        // MOVE_ONE is signed so a falling span divides toward zero
+        uint32_t word = from + span * move_shape(profile, k, n) / MOVE_ONE;
+        for (int i = 0; i < 4; i++) ftw[i] = word >> (24 - 8 * i);
+        uint32_t t = (uint64_t)total * (k + 1) / n - (uint64_t)total * k / n;
+        pattern.touched |= 1u << channel;
+        if (!pattern_emit(t)) return false;
+    }
+
+    // the end word goes out with whatever comes next
+    get_ftw_mhz(&ad9959, end, ftw);
+    pattern.pending = true;
+    pattern.touched |= 1u << channel;
+    return true;
+}
+
+bool pattern_end(uint passes) {
+    // anything still waiting on a dwell gets the shortest one
+    if (pattern.pending && !pattern_flush(0)) return false;
+    return set_end(pattern.addr, passes != 1, passes);
+}
+
+bool pattern_load(const pattern_preset *p) {
+    pattern_begin(p->channels);
+    for (size_t i = 0; i < p->len; i++) {
+        if (!pattern_add(&p->steps[i])) return false;
+    }
+    return pattern_end(p->passes);
+}
+
+// =============================================================================
+// Pattern Presets
+// =============================================================================
+
+// the default tweezer sites, see Tweezer Sites
+#define SITE0 AT_SITE(0)
+#define SITE1 AT_SITE(1)
+#define SITE2 AT_SITE(2)
+#define SITE3 AT_SITE(3)
+#define SITE4 AT_SITE(4)
+#define SITE5 AT_SITE(5)
+#define OFF 0, 0
+
+// channel 1 runs at full amplitude on the offset grid
+#define ROW(f) FREQ(f), KEEP_AMP
+#define ROW_ON 1, KEEP_FREQ, AMP(1.0), 0
+
+// 2 diagonal points
+static const pattern_step pattern1[] = {
+    {0, SITE0, 0}, {1, FREQ(86), AMP(1.0), 1000},
+    {0, SITE4, 0}, {1, FREQ(114), AMP(1.0), 1000},
+};
+
+static const pattern_step pattern2[] = {
+    {ROW_ON},
+    {1, ROW(86), 1000},
+    {0, SITE1, 1000}, {0, SITE2, 1000}, {0, SITE3, 1000}, {0, SITE4, 1000},
+    {1, ROW(86), 1000}, {1, ROW(93), 1000}, {1, ROW(100), 1000}, {1, ROW(107), 1000},
+    {1, ROW(114), 1000},
+    {0, SITE3, 1000}, {0, SITE2, 1000}, {0, SITE1, 1000}, {0, SITE0, 1000},
+    {1, ROW(107), 1000}, {1, ROW(100), 1000}, {1, ROW(93), 1000},
+};
+
+static const pattern_step pattern3[] = {
+    {ROW_ON},
+    {0, SITE0, 0}, {1, ROW(86), 1000},
+    {0, SITE1, 1000}, {0, SITE2, 1000}, {0, SITE3, 1000}, {0, SITE4, 1000},
+    {0, SITE2, 0}, {1, ROW(93), 1000},
+    {1, ROW(100), 1000}, {1, ROW(107), 1000}, {1, ROW(114), 1000},
+};
+
+static const pattern_step pattern4[] = {
+    {ROW_ON},
+    {0, SITE2, 0}, {1, ROW(114), 1000},
+    {1, ROW(107), 0}, {0, SITE1, 1000},
+    {0, SITE3, 1000},
+    {1, ROW(100), 0}, {0, SITE0, 1000},
+    {0, SITE4, 1000},
+    {1, ROW(93), 0}, {0, SITE0, 1000},
+    {0, SITE2, 1000},
+    {0, SITE4, 1000},
+    {1, ROW(86), 0}, {0, SITE1, 1000},
+    {0, SITE3, 1000},
+};
+
+static const pattern_step pattern5[] = {
+    {ROW_ON},
+    {1, ROW(86), 0}, {0, SITE1, 1000},
+    {0, SITE2, 1000}, {0, SITE3, 1000},
+    {0, SITE4, 0}, {1, ROW(93), 1000},
+    {1, ROW(100), 1000}, {1, ROW(107), 1000},
+    {0, SITE3, 0}, {1, ROW(114), 1000},
+    {0, SITE2, 1000}, {0, SITE1, 1000},
+    {1, ROW(107), 0}, {0, SITE0, 1000},
+    {1, ROW(100), 1000}, {1, ROW(93), 1000},
+    {0, SITE1, 1000}, {0, SITE3, 1000},
+    {1, ROW(107), 0}, {0, SITE1, 1000},
+    {0, SITE2, 1000}, {0, SITE3, 1000},
+};
+
+static const pattern_step pattern6[] = {
+    {ROW_ON},
+    {1, ROW(86), 1000},
+    {0, SITE1, 1000}, {0, SITE2, 1000}, {0, SITE3, 1000}, {0, SITE4, 1000}, {0, SITE0, 1000},
+    {1, ROW(100), 1000},
+    {0, SITE1, 1000}, {0, SITE2, 1000}, {0, SITE3, 1000}, {0, SITE4, 1000}, {0, SITE0, 1000},
+    {1, ROW(114), 1000}, {1, ROW(107), 1000}, {1, ROW(92), 1000},
+};
+
+static const pattern_step pattern7[] = {
+    {ROW_ON},
+    {1, ROW(86), 0}, {0, SITE0, 1000},
+    {0, SITE4, 1000},
+    {1, ROW(93), 0}, {0, SITE1, 1000},
+    {0, SITE3, 1000},
+    {1, ROW(100), 0}, {0, SITE2, 1000},
+    {1, ROW(107), 0}, {0, SITE1, 1000},
+    {0, SITE3, 1000},
+    {1, ROW(114), 0}, {0, SITE0, 1000},
+    {0, SITE4, 1000},
+};
+
+// every site in turn with the beam switched off in between
+static const pattern_step custom[] = {
+    {0, SITE0, 1000}, {0, OFF, 1}, {0, SITE1, 1000}, {0, OFF, 1},
+    {0, SITE2, 1000}, {0, OFF, 1}, {0, SITE3, 1000}, {0, OFF, 1},
+    {0, SITE4, 1000}, {0, OFF, 1}, {0, SITE5, 1000}, {0, OFF, 1},
+};
+
+// every other site
+static const pattern_step cust[] = {
+    {0, SITE0, 1000}, {0, OFF, 1}, {0, SITE1, 1000}, {0, OFF, 1000},
+    {0, SITE3, 1000}, {0, OFF, 1000}, {0, SITE5, 1000}, {0, OFF, 1},
+};
+
+// slow toggle between two sites for checking the amplitudes by eye
+static const pattern_step checkv[] = {
+    {0, FREQ(92.5), AMP(0.685), 1000000},
+    {0, FREQ(99.5), AMP(0.716), 2000000},
+};
+
+#define PRESET(name, steps, channels, passes) \
+    {name, steps, sizeof steps / sizeof steps[0], channels, passes}
+
+static const pattern_preset presets[] = {
+    PRESET("pattern1", pattern1, 2, 10001), PRESET("pattern2", pattern2, 2, 10001),
+    PRESET("pattern3", pattern3, 2, 10001), PRESET("pattern4", pattern4, 2, 10001),
+    PRESET("pattern5", pattern5, 2, 10001), PRESET("pattern6", pattern6, 2, 10001),
+    PRESET("pattern7", pattern7, 2, 10001), PRESET("Custom", custom, 1, 30000),
+    PRESET("Cust", cust, 1, 30000),         PRESET("checkv", checkv, 1, 30000),
+};
+
+const pattern_preset *find_preset(const char *cmd) {
+    for (size_t i = 0; i < sizeof presets / sizeof presets[0]; i++) {
+        size_t len = strlen(presets[i].name);
+        if (strncmp(cmd, presets[i].name, len) == 0 && (cmd[len] == '\0' || isspace(cmd[len]))) {
+            return &presets[i];
+        }
+    }
+    return NULL;
+}
+
+// =============================================================================
+// Rearrangement
+// =============================================================================
+
+// Sorts atoms onto target sites from an occupancy bitmap, so the first move
+// does not wait on a round trip through the host. Channel 0 is the moving
+// tweezer: it switches on over an atom, glides it to its target with a
+// minimum jerk move, holds it there and switches off again.
+//
+// On a line the cheapest assignment keeps the atoms in order. When there are
+// more atoms than targets a small dynamic program picks which atoms to use,
+// the rest stay where they are. Moves to the left run from the left end and
+// moves to the right from the right end, so no atom is set down on a site
+// that is still occupied.
+
+// time on a site before and after each move
+#define REARRANGE_HOLD_US 50
+#define REARRANGE_MOVE_US 100
+
+uint site_list(uint32_t bitmap, uint8_t *list) {
+    uint n = 0;
+    for (uint i = 0; i < sites.count; i++) {
+        if (bitmap & (1u << i)) list[n++] = i;
+    }
+    return n;
+}
+
+uint32_t site_distance(uint a, uint b) {
+    // kHz is plenty and keeps the sums in 32 bits
+    uint64_t fa = sites.list[a].freq, fb = sites.list[b].freq;
+    return (fa > fb ? fa - fb : fb - fa) / 1000000;
+}
+
+uint plan_moves(uint32_t occupied, uint32_t target, uint8_t *from, uint8_t *to) {
+    // returns the number of atoms that go to a target, from[k] goes to to[k]
+    uint8_t atoms[MAX_SITES], targets[MAX_SITES];
+    uint n = site_list(occupied, atoms);
+    uint m = site_list(target, targets);
+
+    // cost[i][j] is the cheapest way to fill the first j targets from the
+    // first i atoms, static to keep it off the stack
+    static uint32_t cost[MAX_SITES + 1][MAX_SITES + 1];
+    for (uint i = 0; i <= n; i++) {
+        for (uint j = 0; j <= m && j <= i; j++) {
+            if (j == 0) {
+                cost[i][j] = 0;
+                continue;
+            }
+            uint32_t use = cost[i - 1][j - 1] + site_distance(atoms[i - 1], targets[j - 1]);
+            cost[i][j] = j < i && cost[i - 1][j] < use ? cost[i - 1][j] : use;
+        }
+    }
+
+    // walk back to see which atoms were used
+    for (uint i = n, j = m; j > 0; i--) {
+        if (j < i && cost[i][j] == cost[i - 1][j]) continue;
+        j--;
+        from[j] = atoms[i - 1];
+        to[j] = targets[j];
+    }
+    return m;
+}
+
+bool rearrange_move(uint from, uint to, uint move_us) {
+    pattern_step pick = {0, AT_SITE(from), REARRANGE_HOLD_US};
+    pattern_step place = {0, AT_SITE(to), REARRANGE_HOLD_US};
+    pattern_step release = {0, KEEP_FREQ, 0, 1};
+    return pattern_add(&pick) &&
+           pattern_move(0, KEEP_FREQ, sites.list[to].freq, move_us, MOVE_MIN_JERK) &&
+           pattern_add(&place) && pattern_add(&release);
+}
+
+bool rearrange(uint32_t occupied, uint32_t target, uint move_us) {
+    // compiles the moves into a single pass pattern on one channel
+    uint8_t from[MAX_SITES], to[MAX_SITES];
+    uint moves = plan_moves(occupied, target, from, to);
+
+    pattern_begin(1);
+    for (uint k = 0; k < moves; k++) {
+        if (to[k] < from[k] && !rearrange_move(from[k], to[k], move_us)) return false;
+    }
+    for (uint k = moves; k-- > 0;) {
+        if (to[k] > from[k] && !rearrange_move(from[k], to[k], move_us)) return false;
+    }
+    return pattern_end(1);
+}
+
+// =============================================================================
+// Flash Slots
+// =============================================================================
+
+// Tables are saved by name into slots that fill the flash from
+// FLASH_TARGET_OFFSET up. A slot is a header sector and room for a whole
+// instruction buffer, but only the sectors a table uses are written: the
+// records up to the end record, then the waits from the next page. Each of
+// those is compared with what is in flash first and only erased and
+// programmed if it changed, so saving a small edit touches a sector or two.
+// The header is erased first and goes in last, so a slot only counts once
+// it is whole. It also keeps how often each sector of the slot has been
+// erased, and delete only clears the magic so the counts carry on.
+// Slots can be loaded into a bank or played straight from XIP flash.
+#define SLOT_SECTORS 64
+#define SLOT_SIZE (SLOT_SECTORS * FLASH_SECTOR_SIZE)
+#define NUM_SLOTS ((PICO_FLASH_SIZE_BYTES - FLASH_TARGET_OFFSET) / SLOT_SIZE)
+#define SLOT_OFFSET(slot) (FLASH_TARGET_OFFSET + (slot) * SLOT_SIZE)
+#define SLOT_NAME 16
+#define SLOT_MAGIC 0x544f4c53
+// the magic of a deleted slot, programmed over the old one
+#define SLOT_FREE 0
+// save and load without a name use this slot
+#define DEFAULT_SLOT "default"
+// run_bank while a slot plays from flash
+#define FLASH_BANK MAX_BANKS
+
+typedef struct slot_header {
+    uint32_t magic;
+    char name[SLOT_NAME];
+    table_bank layout;
+    // bytes of records and number of waits, the waits start at waits_at
+    uint32_t length;
+    uint32_t waits;
+    uint32_t waits_at;
+    // crc32 of the header up to here, then the records and the waits. The
+    // erase counts change on every save so they are left out.
+    uint32_t crc;
+    // erases of each sector, the header sector first
+    uint32_t erases[SLOT_SECTORS];
+} slot_header;
+
+const slot_header *slot_at(uint slot) {
+    return (const slot_header *)(XIP_BASE + SLOT_OFFSET(slot));
+}
+
+const uint8_t *slot_data(uint slot) {
+    return (const uint8_t *)(XIP_BASE + SLOT_OFFSET(slot) + FLASH_SECTOR_SIZE);
+}
+
+bool slot_used(uint slot) { return slot_at(slot)->magic == SLOT_MAGIC; }
+
+int find_slot(const char *name) {
+    for (uint i = 0; i < NUM_SLOTS; i++) {
+        if (slot_used(i) && strncmp(slot_at(i)->name, name, SLOT_NAME) == 0) return i;
+    }
+    return -1;
+}
+
+uint32_t slot_crc(const slot_header *h, const uint8_t *records, const uint32_t *waits) {
+    uint32_t crc = crc32(0, (const uint8_t *)h, offsetof(slot_header, crc));
+    crc = crc32(crc, records, h->length);
+    return crc32(crc, (const uint8_t *)waits, h->waits * 4);
+}
+
+bool slot_valid(uint slot) {
+    // sizes are checked before the CRC, so a bad header cannot send it
+    // reading past the slot
+    const slot_header *h = slot_at(slot);
+    const uint8_t *data = slot_data(slot);
+    uint space = SLOT_SIZE - FLASH_SECTOR_SIZE;
+    if (h->length > space || h->waits > TIMERS || h->waits_at > space - h->waits * 4) {
+        return false;
+    }
+    return slot_crc(h, data, (const uint32_t *)(data + h->waits_at)) == h->crc;
+}
+
+// core1 runs from flash even while it waits for a start message, so it is
+// parked in RAM with its interrupts off while the flash is written
+volatile bool core1_parked = false;
+
+void __not_in_flash_func(core1_park)() {
+    uint32_t ints = save_and_disable_interrupts();
+    core1_parked = true;
+    while (core1_parked) tight_loop_contents();
+    restore_interrupts(ints);
+}
+
+static void park_core1() {
+    multicore_fifo_push_blocking(PARK_CORE1);
+    while (!core1_parked) tight_loop_contents();
+}
+
+static void release_core1() { core1_parked = false; }
+
+static void program_pages(uint32_t offset, const uint8_t *data, uint len) {
+    // a page at a time, the last one padded out. Interrupts are only off
+    // for each flash operation so USB keeps up during a long save.
+    uint8_t page[FLASH_PAGE_SIZE];
+    for (uint at = 0; at < len; at += FLASH_PAGE_SIZE) {
+        uint n = len - at < FLASH_PAGE_SIZE ? len - at : FLASH_PAGE_SIZE;
+        memset(page, 0xff, sizeof page);
+        memcpy(page, data + at, n);
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_program(offset + at, page, FLASH_PAGE_SIZE);
+        restore_interrupts(ints);
+    }
+}
+
+static void erase_sector(uint32_t offset) {
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+}
+
+static void copy_span(uint8_t *page, uint at, const uint8_t *src, uint start, uint len) {
+    // the part of src, which starts at byte start of the slot data, that
+    // falls in the page at byte at
+    uint lo = at > start ? at : start;
+    uint hi = at + FLASH_PAGE_SIZE < start + len ? at + FLASH_PAGE_SIZE : start + len;
+    if (lo < hi) memcpy(page + lo - at, src + lo - start, hi - lo);
+}
+
+static void slot_page(const slot_header *h, const uint8_t *records, const uint32_t *waits,
+                      uint at, uint8_t *page) {
+    // the page at byte at of the slot data as it should be in flash
+    memset(page, 0xff, FLASH_PAGE_SIZE);
+    copy_span(page, at, records, 0, h->length);
+    copy_span(page, at, (const uint8_t *)waits, h->waits_at, h->waits * 4);
+}
+
+static bool sector_same(uint slot, const slot_header *h, const uint8_t *records,
+                        const uint32_t *waits, uint sector) {
+    uint8_t page[FLASH_PAGE_SIZE];
+    const uint8_t *flash = slot_data(slot);
+    uint end = (sector + 1) * FLASH_SECTOR_SIZE;
+    for (uint at = sector * FLASH_SECTOR_SIZE; at < end; at += FLASH_PAGE_SIZE) {
+        slot_page(h, records, waits, at, page);
+        if (memcmp(page, flash + at, FLASH_PAGE_SIZE) != 0) return false;
+    }
+    return true;
+}
+
+bool slot_counted(uint slot) {
+    // the counts are kept by slots that were used or deleted, a header that
+    // was never written reads back as all ones
+    return slot_at(slot)->magic == SLOT_MAGIC || slot_at(slot)->magic == SLOT_FREE;
+}
+
+uint slot_write(uint slot, slot_header *h, const uint8_t *records, const uint32_t *waits) {
+    // returns the number of sectors erased, 0 when the slot already held
+    // the same table. h gets the erase counts.
+    const slot_header *old = slot_at(slot);
+    uint used = h->waits_at + h->waits * 4;
+    uint sectors = (used + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+
+    if (slot_counted(slot)) {
+        memcpy(h->erases, old->erases, sizeof h->erases);
+    } else {
+        memset(h->erases, 0, sizeof h->erases);
+    }
+
+    uint64_t changed = 0;
+    for (uint i = 0; i < sectors; i++) {
+        if (!sector_same(slot, h, records, waits, i)) changed |= 1ull << i;
+    }
+    if (!changed && memcmp(h, old, sizeof *h) == 0) return 0;
+
+    uint32_t offset = SLOT_OFFSET(slot);
+    uint erased = 1;
+    park_core1();
+    h->erases[0]++;
+    erase_sector(offset);
+
+    uint8_t page[FLASH_PAGE_SIZE];
+    for (uint i = 0; i < sectors; i++) {
+        if (!(changed & (1ull << i))) continue;
+        uint32_t sector = offset + (i + 1) * FLASH_SECTOR_SIZE;
+        erase_sector(sector);
+        h->erases[i + 1]++;
+        erased++;
+
+        // pages left blank are as the erase left them
+        for (uint at = 0; at < FLASH_SECTOR_SIZE; at += FLASH_PAGE_SIZE) {
+            slot_page(h, records, waits, i * FLASH_SECTOR_SIZE + at, page);
+            bool blank = true;
+            for (uint k = 0; blank && k < FLASH_PAGE_SIZE; k++) blank = page[k] == 0xff;
+            if (!blank) program_pages(sector + at, page, FLASH_PAGE_SIZE);
+        }
+    }
+    program_pages(offset, (const uint8_t *)h, sizeof *h);
+    release_core1();
+    return erased;
+}
+
+void slot_delete(uint slot) {
+    // programs the magic to zero, which needs no erase
+    slot_header h;
+    memset(&h, 0xff, sizeof h);
+    h.magic = SLOT_FREE;
+    park_core1();
+    program_pages(SLOT_OFFSET(slot), (const uint8_t *)&h, sizeof h);
+    release_core1();
+}
+
+uint32_t slot_wear(uint slot) {
+    // erases of the most worn sector
+    uint32_t most = 0;
+    if (!slot_counted(slot)) return 0;
+    for (uint i = 0; i < SLOT_SECTORS; i++) {
+        if (slot_at(slot)->erases[i] > most) most = slot_at(slot)->erases[i];
+    }
+    return most;
+}
+
+// =============================================================================
+// Step Telemetry
+// =============================================================================
+
+// background() stamps every step into a ring in RAM: when it armed the
+// trigger, when the frame for the step was fully out on SPI and when the
+// IO_UPDATE came back from the trigger program. That program pulses
+// IO_UPDATE on the cycle it sees the trigger, so the last stamp is also when
+// the trigger was seen. Stamps are core1 SysTick cycles since the run started.
+#define TELEMETRY_SIZE 128
+
+// step flags
+#define STEP_FIRED 1     // the IO_UPDATE went out, clear if the run stopped on this step
+#define STEP_LATE 2      // the frame was not seen done before the IO_UPDATE
+#define STEP_OVERRUN 4   // the trigger was already due when the step was armed
+
+typedef struct step_record {
+    uint16_t ins;
+    uint8_t bank;
+    uint8_t flags;
+    uint32_t armed;
+    uint32_t spi_done;
+    uint32_t update;
+} step_record;
+
+struct {
+    step_record ring[TELEMETRY_SIZE];
+    uint steps, late, overruns;
+    // SysTick is 24 bits, every read carries it on into now. It wraps about
+    // every 134 ms, so every loop core1 can sit in while a table runs reads it.
+    uint32_t now, last;
+} telemetry;
+
+static inline uint32_t cycles() {
+    uint32_t t = systick_hw->cvr;
+    telemetry.now += (telemetry.last - t) & 0xffffff;
+    telemetry.last = t;
+    return telemetry.now;
+}
+
+void telemetry_reset() {
+    telemetry.steps = telemetry.late = telemetry.overruns = 0;
+    telemetry.now = 0;
+    telemetry.last = systick_hw->cvr;
+}
+
+step_record *arm_step(uint ins, bool timed, uint32_t due) {
+    // called just before the trigger byte goes to the PIO. A trigger that is
+    // already high will fire the step the moment it is armed.
+    step_record *rec = &telemetry.ring[telemetry.steps++ % TELEMETRY_SIZE];
+    rec->ins = ins;
+    rec->bank = run_bank;
+    rec->flags = 0;
+    rec->armed = cycles();
+    if (gpio_get(TRIGGER) || (timed && (int32_t)(rec->armed - due) > 0)) {
+        rec->flags = STEP_OVERRUN;
+        telemetry.overruns++;
+    }
+    return rec;
+}
+
+uint32_t wait(step_record *rec) {
+    // polls instead of blocking on the fifo so the end of the frame can be
+    // stamped while waiting
+    // the frame only counts as sent if it was done before a look at the
+    // fifo that found no IO_UPDATE yet
+    bool sent = false;
+    while (true) {
+        uint32_t now = cycles();
+        bool done = !spi_dma_busy();
+        if (!pio_sm_is_rx_fifo_empty(PIO_TRIG, 0)) break;
+        if (!sent && done) {
+            rec->spi_done = now;
+            sent = true;
+        }
+    }
+    pio_sm_get(PIO_TRIG, 0);
+    rec->update = cycles();
+    rec->flags |= STEP_FIRED;
+    triggers++;
+
+    // a frame that was not seen done before the IO_UPDATE counts as late,
+    // even if it finished by the time the fifo was read
+    if (!sent) {
+        rec->flags |= STEP_LATE;
+        telemetry.late++;
+        while (spi_dma_busy()) tight_loop_contents();
+        rec->spi_done = cycles();
+    }
+    return rec->update;
+}
+
+// =============================================================================
+// Table Running Loop
+// =============================================================================
+
+typedef struct call_frame {
+    uint32_t at;
+    uint32_t left;
+} call_frame;
+
+typedef struct run_state {
+    // a bank in RAM, or a slot played straight from flash. base is where
+    // the records start, they are stride apart and step long once unpacked,
+    // or where index says for a sparse table.
+    const uint8_t *base;
+    const uint32_t *waits;
+    const uint8_t *palette;
+    const uint32_t *index;
+    bool in_flash;
+    uint step;
+    uint stride;
+    uint ins_size;
+    bool timing;
+    int num_ins;
+    bool repeat;
+    uint32_t repeats;
+    // loops and calls still open, see run_control()
+    call_frame stack[CALL_DEPTH];
+    uint depth;
+} run_state;
+
+void prepare_bank(const table_bank *layout, uint bank) {
+    // single step instructions do not carry a CFR, the first IO_UPDATE of
+    // the table applies this one
+    if (layout->sweep_type == SS_MODE) {
+        spi_dma_wait();
+        single_step_mode();
+    }
+    run_bank = bank;
+}
+
+static inline uint record_at(const run_state *run, uint i) {
+    return run->index ? run->index[i] : run->stride * i;
+}
+
+const uint8_t *run_record(const run_state *run, uint i, uint8_t *raw) {
+    // a record as it would be stored raw, packed ones are unpacked into raw.
+    // Sparse steps are not, only their trigger byte and controls match.
+    const uint8_t *rec = run->base + record_at(run, i);
+    if (!run->palette) return rec;
+    unpack(run->palette, run->ins_size, rec, run->stride, raw);
+    return raw;
+}
+
+void load_table(run_state *run, const table_bank *layout, uint bank, uint size) {
+    // base and waits are set by the caller, size is how far the table goes
+    run->step = layout->ins_size * layout->channels + 1;
+    run->stride = record_size(layout);
+    run->ins_size = layout->ins_size;
+    run->timing = layout->timing;
+
+    // count instructions to run
+    uint limit = (size - records_offset(layout)) / run->stride;
+    run->num_ins = table_end(layout, run->base, limit);
+    run->palette = layout->palette_size ? run->base : NULL;
+    run->index = NULL;
+    if (layout->sparse) {
+        // a sparse table has no index until it is ended, and nothing to run
+        if (run->num_ins == (int)limit) run->num_ins = limit = 0;
+        uint32_t index_at = ((const sparse_header *)run->base)->index_at;
+        if (limit) run->index = (const uint32_t *)(run->base + index_at);
+    }
+    run->base += records_offset(layout);
+    run->repeat = false;
+    run->repeats = 0;
+    run->depth = 0;
+    uint8_t raw[MAX_RECORD];
+    const uint8_t *end = (uint)run->num_ins < limit ? run_record(run, run->num_ins, raw) : NULL;
+    if (end && end[1] == CTRL_REPEAT) {
+        run->repeat = true;
+        memcpy(&run->repeats, end + 2, 4);
+    }
+
+    prepare_bank(layout, bank);
+}
+
+void load_run(run_state *run, uint bank) {
+    run->base = instructions + bank * bank_size;
+    run->waits = (const uint32_t *)(run->base + TIMING_OFFSET);
+    run->in_flash = false;
+    load_table(run, &banks[bank], bank, bank_size);
+}
+
+void load_slot_run(run_state *run, uint slot) {
+    // start_run() has already checked the slot with slot_valid()
+    const slot_header *h = slot_at(slot);
+    run->base = slot_data(slot);
+    run->waits = (const uint32_t *)(run->base + h->waits_at);
+    run->in_flash = true;
+    load_table(run, &h->layout, FLASH_BANK, h->length);
+}
+
+static inline void prefetch(const void *p, uint len) {
+    // a read for every line of the XIP cache it covers
+    const volatile uint8_t *bytes = p;
+    for (uint i = 0; i < len; i += 8) (void)bytes[i];
+    (void)bytes[len - 1];
+}
+
+void swap_bank(run_state *run) {
+    // if the old table was cut short, drop the rest of its waits. The wait
+    // that is already counting down still sets when the next trigger fires.
+    if (run->timing) {
+        dma_channel_abort(timer_dma);
+        pio_sm_clear_fifos(PIO_TIME, 0);
+    }
+    load_run(run, pending_bank);
+    pending_bank = -1;
+}
+
+// A loop record jumps back to its target until the records in between have
+// run count times. While it runs it keeps a frame on the stack with the
+// passes left, so an inner loop starts counting afresh each time the outer
+// one comes round. A call keeps a frame with the address to return to.
+// Stack frames take no table space, and a table that nests deeper than
+// CALL_DEPTH ends the pass there.
+#define CALL_FRAME UINT32_MAX
+
+int run_loop(run_state *run, int i, uint32_t target, uint32_t count) {
+    call_frame *top = run->depth > 0 ? &run->stack[run->depth - 1] : NULL;
+    if (top && top->at == (uint32_t)i && top->left != CALL_FRAME) {
+        if (--top->left > 0) return target;
+        run->depth--;
+        return i + 1;
+    }
+    if (count <= 1) return i + 1;
+    if (run->depth == CALL_DEPTH) return run->num_ins;
+    run->stack[run->depth++] = (call_frame){i, count - 1};
+    return target;
+}
+
+int run_return(run_state *run, int i) {
+    // loops the subroutine left open are dropped along with its frame
+    while (run->depth > 0) {
+        run->depth--;
+        if (run->stack[run->depth].left == CALL_FRAME) return run->stack[run->depth].at;
+    }
+    return i + 1;
+}
+
+int run_control(run_state *run, int i, const uint8_t *ins) {
+    // returns the instruction to go on with. The feedback pin is read by
+    // core1 as it gets to the record, so a decision takes a few cycles.
+    uint32_t target, count;
+    memcpy(&target, ins + 2, 4);
+    memcpy(&count, ins + 6, 4);
+    if (target > (uint32_t)run->num_ins) target = run->num_ins;
+
+    uint8_t op = ins[1];
+    if (op == CTRL_WAIT_LOW || op == CTRL_WAIT_HIGH) {
+        bool level = op == CTRL_WAIT_HIGH;
+        while (gpio_get(PIN_FEEDBACK) != level && status != ABORTING) {
+            cycles();
+            tight_loop_contents();
+        }
+        return i + 1;
+    } else if (op == CTRL_JUMP_LOW) {
+        return gpio_get(PIN_FEEDBACK) ? i + 1 : (int)target;
+    } else if (op == CTRL_JUMP_HIGH) {
+        return gpio_get(PIN_FEEDBACK) ? (int)target : i + 1;
+    } else if (op == CTRL_LOOP) {
+        return run_loop(run, i, target, count);
+    } else if (op == CTRL_CALL) {
+        if (run->depth == CALL_DEPTH) return run->num_ins;
+        run->stack[run->depth++] = (call_frame){i + 1, CALL_FRAME};
+    } else if (op == CTRL_RETURN) {
+        return run_return(run, i);
+    }
+    return target;
+}
+
+// Hardware playback plays a table with no CPU in the loop, so USB or flash
+// traffic on either core cannot hold a step up. Two DMA channels stream the
+// records of a pass into step_frame and step_trigger on the trigger PIO, see
+// trigger_timer.pio, and a third counts the IO_UPDATEs step_trigger pushes.
+// Core1 only starts each pass and waits for the count. Packed and sparse
+// tables and tables with control records before their end run on the CPU
+// as before.
+// Swaps wait for the end of the pass and no step telemetry is stamped.
+#define SEQ_FRAME_SM 1
+#define SEQ_TRIG_SM 2
+// IRQ flags the two programs pass between them
+#define SEQ_ARMED_IRQ 3
+#define SEQ_FRAME_IRQ 4
+#define SEQ_UPDATE_IRQ 5
+
+bool hw_playback = false;
+
+static uint seq_frame_offset, seq_trig_offset;
+static uint seq_frame_dma, seq_trig_dma, seq_count_dma;
+static uint32_t seq_sink;
+
+static uint seq_dma(uint sm) {
+    // a byte at a time from the table into the state machine
+    uint channel = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, pio_get_dreq(PIO_TRIG, sm, true));
+    dma_channel_configure(channel, &c, &PIO_TRIG->txf[sm], instructions, 0, false);
+    return channel;
+}
+
+void seq_init() {
+    const pio_program_t *frame = SERIAL_BITS == 4 ? &step_frame_quad_program : &step_frame_program;
+    seq_frame_offset = pio_add_program(PIO_TRIG, frame);
+    seq_trig_offset = pio_add_program(PIO_TRIG, &step_trigger_program);
+
+    seq_frame_dma = seq_dma(SEQ_FRAME_SM);
+    seq_trig_dma = seq_dma(SEQ_TRIG_SM);
+
+    // every push is read into the sink, what is left of the count is how
+    // many steps have not fired yet
+    seq_count_dma = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(seq_count_dma);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(PIO_TRIG, SEQ_TRIG_SM, false));
+    dma_channel_configure(seq_count_dma, &c, &seq_sink, &PIO_TRIG->rxf[SEQ_TRIG_SM], 0, false);
+}
+
+bool seq_playable(const run_state *run) {
+    if (run->num_ins == 0 || run->palette || run->index) return false;
+    for (int i = 0; i < run->num_ins; i++) {
+        if (run->base[run->step * i] == 0x00) return false;
+    }
+    return true;
+}
+
+static void seq_set_y(uint sm, uint32_t value) {
+    // Y is loaded through the OSR, which is emptied again after
+    pio_sm_put(PIO_TRIG, sm, value);
+    pio_sm_exec(PIO_TRIG, sm, pio_encode_pull(false, false));
+    pio_sm_exec(PIO_TRIG, sm, pio_encode_mov(pio_y, pio_osr));
+    pio_sm_exec(PIO_TRIG, sm, pio_encode_out(pio_null, 32));
+}
+
+void seq_start(run_state *run) {
+    // step_frame takes the serial port pins over for the pass
+    uint frame = run->step - 1;
+    if (SERIAL_BITS == 4) {
+        step_frame_program_init(PIO_TRIG, SEQ_FRAME_SM, seq_frame_offset, PIN_SDIO0, 4, PIN_SCLK);
+    } else {
+        step_frame_program_init(PIO_TRIG, SEQ_FRAME_SM, seq_frame_offset, PIN_MOSI, 1, PIN_SCK);
+    }
+    step_trigger_program_init(PIO_TRIG, SEQ_TRIG_SM, seq_trig_offset, TRIGGER, P3, PIN_UPDATE);
+    seq_set_y(SEQ_FRAME_SM, frame * 8 / SERIAL_BITS - 1);
+    seq_set_y(SEQ_TRIG_SM, frame - 1);
+    pio_interrupt_clear(PIO_TRIG, SEQ_ARMED_IRQ);
+    pio_interrupt_clear(PIO_TRIG, SEQ_FRAME_IRQ);
+    pio_interrupt_clear(PIO_TRIG, SEQ_UPDATE_IRQ);
+
+    dma_channel_set_trans_count(seq_count_dma, run->num_ins, true);
+    pio_sm_set_enabled(PIO_TRIG, SEQ_TRIG_SM, true);
+    pio_sm_set_enabled(PIO_TRIG, SEQ_FRAME_SM, true);
+    dma_channel_transfer_from_buffer_now(seq_trig_dma, run->base, run->step * run->num_ins);
+    dma_channel_transfer_from_buffer_now(seq_frame_dma, run->base, run->step * run->num_ins);
+}
+
+void seq_stop() {
+    // no IO_UPDATE goes out after this. A frame that is on its way out is
+    // let finish so the serial port of the AD9959 stays in step, step_frame
+    // then sits waiting for the IO_UPDATE, or for a table that ran out.
+    pio_sm_set_enabled(PIO_TRIG, SEQ_TRIG_SM, false);
+    uint wait_update = seq_frame_offset + step_frame_offset_wait_update;
+    while (true) {
+        uint pc = pio_sm_get_pc(PIO_TRIG, SEQ_FRAME_SM);
+        if (pc == wait_update) break;
+        if (pc == seq_frame_offset && !dma_channel_is_busy(seq_frame_dma) &&
+            pio_sm_is_tx_fifo_empty(PIO_TRIG, SEQ_FRAME_SM)) {
+            break;
+        }
+    }
+    pio_sm_set_enabled(PIO_TRIG, SEQ_FRAME_SM, false);
+    dma_channel_abort(seq_frame_dma);
+    dma_channel_abort(seq_trig_dma);
+    pio_sm_clear_fifos(PIO_TRIG, SEQ_FRAME_SM);
+    pio_sm_clear_fifos(PIO_TRIG, SEQ_TRIG_SM);
+
+    // hand the pins back to spi1 or the 4-bit program
+    if (SERIAL_BITS == 4) {
+        serial_quad_pins();
+    } else {
+        gpio_set_function(PIN_SCK, GPIO_FUNC_SPI);
+        gpio_set_function(PIN_MOSI, GPIO_FUNC_SPI);
+    }
+}
+
+void seq_pass(run_state *run) {
+    uint32_t before = triggers;
+    seq_start(run);
+
+    // the first step is armed once its frame is out, a timed table starts
+    // its timer then as in run_table()
+    while (!pio_interrupt_get(PIO_TRIG, SEQ_ARMED_IRQ) && status != ABORTING) {
+        cycles();
+        tight_loop_contents();
+    }
+    if (run->timing) {
+        dma_channel_transfer_from_buffer_now(timer_dma, run->waits, run->num_ins);
+    }
+
+    while (dma_channel_is_busy(seq_count_dma) && status != ABORTING) {
+        cycles();
+        triggers = before + run->num_ins - dma_channel_hw_addr(seq_count_dma)->transfer_count;
+    }
+    seq_stop();
+    triggers = before + run->num_ins - dma_channel_hw_addr(seq_count_dma)->transfer_count;
+    dma_channel_abort(seq_count_dma);
+}
+
+bool run_hw(run_state *run) {
+    // plays the table a pass at a time until it ends or is aborted. Returns
+    // false when the table in run, maybe swapped in, needs the CPU runner.
+    uint32_t passes = 0;
+    while (seq_playable(run)) {
+        seq_pass(run);
+        if (status == ABORTING) return true;
+
+        // the end of a pass, checked in the same order as run_table()
+        if (pending_bank >= 0) {
+            swap_bank(run);
+            passes = 0;
+        } else if (!run->repeat || (run->repeats != 0 && ++passes >= run->repeats)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// packed records are unpacked into whichever of these the last frame did not
+// go out of, so the DMA is never reading the one being written
+static uint8_t run_frames[2][MAX_RECORD];
+
+void run_table(const run_state *start) {
+    run_state run = *start;
+    if (hw_playback && run_hw(&run)) return;
+
+    uint offset = 0;
+    uint32_t passes = 0;
+    // the timer is (re)started at the start of a pass and after control
+    // records, until then there is no telling when the next step is due
+    bool start_timer = false;
+    bool chained = false;
+    uint32_t due = 0;
+    int i = 0;
+    // frames sent, and the record already unpacked into the spare buffer
+    uint sent = 0;
+    int ahead = -1;
+
+    while (status != ABORTING) {
+        // a swap on the next trigger takes the place of the next instruction
+        if (pending_bank >= 0 && swap_when == NEXT_TRIGGER) {
+            swap_bank(&run);
+            i = offset = passes = 0;
+            ahead = -1;
+        }
+
+        // check if last instruction
+        if (i == run.num_ins) {
+            if (pending_bank >= 0) {
+                swap_bank(&run);
+                i = offset = passes = 0;
+                ahead = -1;
+            } else if (run.repeat && (run.repeats == 0 || ++passes < run.repeats)) {
+                i = offset = 0;
+                run.depth = 0;
+            } else {
+                break;
+            }
+            if (i == run.num_ins) break;
+        }
+        if (i == 0) {
+            start_timer = true;
+            chained = false;
+        }
+
+        // normally unpacked while the step before waited for its trigger,
+        // only after a jump or a new pass does it happen here
+        uint8_t *spare = run_frames[sent & 1];
+        const uint8_t *ins = run.base + offset;
+        if (run.palette) {
+            if (ahead != i) run_record(&run, i, spare);
+            ahead = i;
+            ins = spare;
+        }
+
+        // control records steer the table instead of playing a step. The
+        // wait that is counting down still fires the next step played, the
+        // timer picks up from its wait after that.
+        if (ins[0] == 0x00) {
+            if (run.timing) {
+                dma_channel_abort(timer_dma);
+                pio_sm_clear_fifos(PIO_TIME, 0);
+                start_timer = true;
+            }
+            uint8_t op = ins[1];
+            if (op == CTRL_WAIT_LOW || op == CTRL_WAIT_HIGH) chained = false;
+            i = run_control(&run, i, ins);
+            offset = record_at(&run, i);
+            continue;
+        }
+
+        // queue the new instruction for the AD9959, it lands in the I/O
+        // buffer while core1 goes on to arm the trigger
+        if (run.index) {
+            spi_write_dma(ins + 2, ins[1]);
+        } else {
+            spi_write_dma(ins + 1, run.step - 1);
+        }
+        step_record *rec = arm_step(i, chained, due);
+        spare = run_frames[++sent & 1];
+        ahead = -1;
+
+        // prime PIO
+        pio_sm_put(PIO_TRIG, 0, ins[0]);
+
+        // begin the timer once the frame is out
+        if (start_timer && run.timing) {
+            spi_dma_wait();
+            dma_channel_transfer_from_buffer_now(timer_dma, run.waits + i, run.num_ins - i);
+        }
+        start_timer = false;
+
+        // a table in flash has its next record pulled into the XIP cache
+        // while this step waits for its trigger, a packed one unpacked
+        if (run.palette && i + 1 < run.num_ins) {
+            run_record(&run, i + 1, spare);
+            ahead = i + 1;
+        } else if (run.in_flash) {
+            // a sparse record is at most a length byte longer than a raw one
+            prefetch(run.base + record_at(&run, i + 1), run.index ? run.step + 1 : run.stride);
+        }
+
+        // the timer pulses one wait after this step fires
+        uint32_t fired = wait(rec);
+        chained = run.timing;
+        due = fired + run.waits[i] + TIMER_OVERHEAD;
+
+        offset = record_at(&run, ++i);
+    }
+}
+
+void run_stream(uint bank) {
+    table_bank *layout = &banks[bank];
+    uint step = layout->ins_size * layout->channels + 1;
+    bool first = true;
+    uint32_t fired = 0, due = 0;
+    uint ins = 0;
+
+    prepare_bank(layout, bank);
+
+    // give the host a head start before the first trigger
+    while (!stream.primed && status != ABORTING) {
+        cycles();
+        tight_loop_contents();
+    }
+
+    while (status != ABORTING) {
+        if (stream.tail == stream.head) {
+            if (stream.done) break;
+
+            // the host fell behind, the outputs hold the last instruction
+            // until the next record arrives
+            stream.underruns++;
+            while (stream.tail == stream.head && !stream.done && status != ABORTING) {
+                cycles();
+                tight_loop_contents();
+            }
+            continue;
+        }
+        __dmb();
+
+        uint8_t *record = stream_slot(stream.tail);
+
+        // an empty instruction ends the stream like it ends a table
+        if (record[0] == 0x00) break;
+
+        spi_write_dma(record + 1, step - 1);
+        step_record *rec = arm_step(ins++, layout->timing && !first, due);
+        pio_sm_put(PIO_TRIG, 0, record[0]);
+
+        // waits travel with their records, so they are handed to the timer
+        // one at a time instead of by DMA
+        if (layout->timing) {
+            uint32_t wait_time;
+            memcpy(&wait_time, record + step, 4);
+            due = wait_time + TIMER_OVERHEAD;
+            // a timer already stalled on its pull, after an underrun or when
+            // core1 is late, pulses as soon as the wait goes in, so the frame
+            // has to be out first
+            spi_dma_wait();
+            while (pio_sm_is_tx_fifo_full(PIO_TIME, 0) && status != ABORTING) {
+                cycles();
+                tight_loop_contents();
+            }
+            pio_sm_put(PIO_TIME, 0, wait_time);
+        }
+        first = false;
+
+        fired = wait(rec);
+        due += fired;
+
+        // hand the slot back once the frame is out of it
+        spi_dma_wait();
+        __dmb();
+        stream.tail++;
+    }
+}
+
+void background() {
+    // SysTick free runs on the core clock for the step telemetry
+    systick_hw->rvr = 0xffffff;
+    systick_hw->csr = 0x5;
+
+    // let other core know ready
+    multicore_fifo_push_blocking(0);
+
+    while (true) {
+        // wait for a start command, it carries the bank or flash slot to run
+        uint32_t cmd = multicore_fifo_pop_blocking();
+        if (cmd == PARK_CORE1) {
+            core1_park();
+            continue;
+        }
+
+        set_status(RUNNING);
+        triggers = 0;
+        telemetry_reset();
+
+        // sync just to be sure
+        sync();
+
+        // if this is hwstart, stell the timer pio core and it will handle that on its own
+        if (cmd & START_HW) {
+            pio_sm_put(PIO_TIME, 0, 0);
+        }
+
+        run_state run;
+        if (cmd & START_STREAM) {
+            run_stream(cmd >> START_BANK_SHIFT);
+        } else if (cmd & START_FLASH) {
+            load_slot_run(&run, cmd >> START_BANK_SHIFT);
+            run_table(&run);
+        } else {
+            load_run(&run, cmd >> START_BANK_SHIFT);
+            run_table(&run);
+        }
+
+        // clean up
+        spi_dma_wait();
+        dma_channel_abort(timer_dma);
+        pio_sm_clear_fifos(PIO_TRIG, 0);
+        pio_sm_clear_fifos(PIO_TIME, 0);
+        pending_bank = -1;
+        set_status(STOPPED);
+    }
+}
+
+// =============================================================================
+// Latency Benchmark
+// =============================================================================
+
+// The latency program runs on a spare state machine of the timer PIO and
+// stands in for the external trigger. It raises TRIGGER, holds it until the
+// trigger program pulses IO_UPDATE and pushes how long that took, then
+// waits out a gap and goes again. The trigger program waits on the level of
+// the pin, so a runner that arms late shows up as extra latency here rather
+// than as a missed trigger. Counts come in 2 cycle steps and include the
+// input synchroniser on IO_UPDATE.
+
+#define LATENCY_SM 1
+// cycles from IO_UPDATE to the next edge on top of the gap count
+#define LATENCY_GAP_OVERHEAD 3
+// 2 cycle bins for the p99, anything slower lands in the last one
+#define LATENCY_BINS 512
+// a run that goes this long without an IO_UPDATE has stalled
+#define LATENCY_TIMEOUT_US 100000
+
+// gaps between IO_UPDATE and the next trigger edge
+static const uint bench_gaps_us[] = {2, 4, 8, 16, 32};
+
+struct {
+    uint32_t min, max, count;
+    uint64_t sum;
+    uint16_t bins[LATENCY_BINS];
+} latency;
+
+static int latency_offset = -1;
+
+void bench_fill(uint steps) {
+    // every step flips between two settings so each IO_UPDATE changes the
+    // outputs, sweeps reverse direction
+    static const double low[] = {0.5, 80e6, 0}, high[] = {1, 81e6, 90};
+    static const double delta[] = {0.001, 1000, 0.1}, hold[] = {1, 80e6, 0};
+    int kind = (ad9959.sweep_type - 1) % 3;
+
+    if (sparse) sparse_clear();
+    for (uint i = 0; i < steps; i++) {
+        bool odd = i & 1;
+        for (uint c = 0; c < ad9959.channels; c++) {
+            if (ad9959.sweep_type == SS_MODE) {
+                set_single_step(i, c, odd ? 81e6 : 80e6, 1, 0);
+            } else {
+                set_sweep(i, c, odd ? high[kind] : low[kind], odd ? low[kind] : high[kind],
+                          delta[kind], 1, hold[kind == 0 ? 1 : 0], hold[kind == 2 ? 1 : 2]);
+            }
+        }
+    }
+    set_end(steps, false, 0);
+}
+
+void latency_add(uint32_t cycles) {
+    uint bin = cycles / 2;
+    if (bin >= LATENCY_BINS) bin = LATENCY_BINS - 1;
+    latency.bins[bin]++;
+    latency.sum += cycles;
+    latency.count++;
+    if (cycles < latency.min) latency.min = cycles;
+    if (cycles > latency.max) latency.max = cycles;
+}
+
+uint32_t latency_p99() {
+    uint32_t need = latency.count - latency.count / 100;
+    uint32_t seen = 0;
+    for (uint i = 0; i < LATENCY_BINS - 1; i++) {
+        seen += latency.bins[i];
+        if (seen >= need) return 2 * i + 1;
+    }
+    return latency.max;
+}
+
+bool bench_run(uint gap_us, uint steps) {
+    // runs the table in the edit bank against the latency program, returns
+    // false if it stalled
+    memset(&latency, 0, sizeof latency);
+    latency.min = UINT32_MAX;
+
+    latency_program_init(PIO_TIME, LATENCY_SM, latency_offset, TRIGGER, PIN_UPDATE);
+    pio_sm_put(PIO_TIME, LATENCY_SM, gap_us * CYCLES_PER_US - LATENCY_GAP_OVERHEAD);
+
+    // the program drives the trigger before the run starts so that no other
+    // edge can get in first, the trigger program waits on the level anyway
+    save_layout();
+    pio_sm_set_enabled(PIO_TIME, LATENCY_SM, true);
+    multicore_fifo_push_blocking(edit_bank << START_BANK_SHIFT);
+    while (get_status() == STOPPED) {
+        tight_loop_contents();
+    }
+
+    // the first edge waits out the start of the run, so it is left out
+    uint got = 0;
+    uint32_t last = time_us_32();
+    while (got < steps && time_us_32() - last < LATENCY_TIMEOUT_US) {
+        if (pio_sm_is_rx_fifo_empty(PIO_TIME, LATENCY_SM)) {
+            tight_loop_contents();
+            continue;
+        }
+        uint32_t cycles = 2 * ~pio_sm_get(PIO_TIME, LATENCY_SM);
+        last = time_us_32();
+        if (got++ > 0) latency_add(cycles);
+    }
+
+    // the program has raised the trigger again for a step that is not there
+    pio_sm_set_enabled(PIO_TIME, LATENCY_SM, false);
+    pio_sm_set_pins_with_mask(PIO_TIME, LATENCY_SM, 0, 1u << TRIGGER);
+
+    if (got < steps) abort_run();
+    while (get_status() != STOPPED) {
+        tight_loop_contents();
+    }
+    return got == steps;
+}
+
+void benchmark(uint steps) {
+    // sweeps the channel count and the gap between steps in the current
+    // mode. The table in the edit bank is overwritten.
+    uint channels = ad9959.channels;
+    bool was_timing = timing;
+
+    if (latency_offset < 0) latency_offset = pio_add_program(PIO_TIME, &latency_program);
+
+    printf("mode %d, %u steps\n", ad9959.sweep_type, steps);
+    printf("channels gap_us min_ns mean_ns p99_ns max_ns\n");
+    for (uint n = 1; n <= 4; n++) {
+        ad9959.channels = n;
+        timing = false;
+        uint count = steps < max_instructions() ? steps : max_instructions();
+        bench_fill(count);
+
+        for (uint g = 0; g < sizeof bench_gaps_us / sizeof bench_gaps_us[0]; g++) {
+            if (!bench_run(bench_gaps_us[g], count)) {
+                printf("%u %u stalled\n", n, bench_gaps_us[g]);
+                continue;
+            }
+            uint32_t ns = 1000 / CYCLES_PER_US;
+            printf("%u %u %u %u %u %u\n", n, bench_gaps_us[g], latency.min * ns,
+                   (uint32_t)(latency.sum * ns / latency.count), latency_p99() * ns,
+                   latency.max * ns);
+        }
+    }
+
+    ad9959.channels = channels;
+    timing = was_timing;
+    save_layout();
+}
+
+// =============================================================================
+// Serial Communication Loop
+// =============================================================================
+
+// Every command is a handler in the sorted table at the bottom of this
+// section. loop() looks the first word of the line up with a binary search
+// and hands the handler the rest of the line. Handlers return REPLY_OK to
+// have loop() answer "ok", or REPLY_DONE when they already printed their
+// response or an error.
+
+#define REPLY_OK 0
+#define REPLY_DONE 1
+
+// may run while a table is running
+#define CMD_ANYTIME 1
+// only touches the bank being edited, so it may run while another bank runs,
+// unless that bank is queued to be swapped to
+#define CMD_EDIT 2
+
+typedef struct command {
+    const char *name;
+    int (*run)(const char *args);
+    uint flags;
+    const char *usage;
+} command;
+
+static const command *current;
+
+int fail(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+    return REPLY_DONE;
+}
+
+int parse(const char *args, int need, const char *fmt, ...) {
+    // sscanf over the arguments, returns how many were read or 0 after
+    // reporting the usage if there were fewer than need
+    va_list ap;
+    va_start(ap, fmt);
+    int parsed = vsscanf(args, fmt, ap);
+    va_end(ap);
+
+    if (parsed < 0) parsed = 0;
+    if (parsed < need) {
+        printf("Missing Argument - expected: %s %s\n", current->name, current->usage);
+        return 0;
+    }
+    return parsed;
+}
+
+bool valid_channel(uint channel) {
+    if (channel < 4) return true;
+    fail("Invalid Channel - channel must be in range 0-3");
+    return false;
+}
+
+// =====================================
+// Status and control
+// =====================================
+
+int cmd_version(const char *args) {
+    printf("%s\n", VERSION);
+    return REPLY_DONE;
+}
+
+int cmd_status(const char *args) {
+    printf("%d\n", get_status());
+    return REPLY_DONE;
+}
+
+int cmd_debug(const char *args) {
+    char state[4];
+    if (!parse(args, 1, "%3s", state)) return REPLY_DONE;
+    if (strcmp(state, "on") == 0) {
+        DEBUG = 1;
+    } else if (strcmp(state, "off") == 0) {
+        DEBUG = 0;
+    } else {
+        return fail("Invalid Argument - expected on or off");
+    }
+    return REPLY_OK;
+}
+
+int cmd_hwplay(const char *args) {
+    // tables are played by the PIO and DMA alone, see run_hw()
+    char state[4];
+    if (!parse(args, 1, "%3s", state)) return REPLY_DONE;
+    if (strcmp(state, "on") == 0) {
+        hw_playback = true;
+    } else if (strcmp(state, "off") == 0) {
+        hw_playback = false;
+    } else {
+        return fail("Invalid Argument - expected on or off");
+    }
+    return REPLY_OK;
+}
+
+int cmd_getfreqs(const char *args) {
+    measure_freqs();
+    return REPLY_DONE;
+}
+
+int cmd_numtriggers(const char *args) {
+    printf("%u\n", triggers);
+    return REPLY_DONE;
+}
+
+int cmd_underruns(const char *args) {
+    printf("%u\n", stream.underruns);
+    return REPLY_DONE;
+}
+
+int cmd_telemetry(const char *args) {
+    // counters of the last run as "steps late overruns records", then the
+    // newest records oldest first as raw bytes and a crc32 over them. Each
+    // record is 16 bytes little endian: u16 instruction, u8 bank, u8 flags
+    // and u32 armed, spi_done and update in cycles from the start of the run.
+    uint records = TELEMETRY_SIZE;
+    parse(args, 0, "%u", &records);
+    if (records > telemetry.steps) records = telemetry.steps;
+    if (records > TELEMETRY_SIZE) records = TELEMETRY_SIZE;
+
+    printf("%u %u %u %u\n", telemetry.steps, telemetry.late, telemetry.overruns, records);
+    if (records == 0) return REPLY_DONE;
+
+    uint32_t crc = 0;
+    for (uint i = telemetry.steps - records; i != telemetry.steps; i++) {
+        const uint8_t *rec = (const uint8_t *)&telemetry.ring[i % TELEMETRY_SIZE];
+        for (uint j = 0; j < sizeof(step_record); j++) putchar_raw(rec[j]);
+        crc = crc32(crc, rec, sizeof(step_record));
+    }
+    for (int j = 0; j < 4; j++) putchar_raw(crc >> (8 * j));
+    return REPLY_DONE;
+}
+
+int cmd_reset(const char *args) {
+    abort_run();
+    reset();
+    set_status(STOPPED);
+    return REPLY_OK;
+}
+
+int cmd_abort(const char *args) {
+    abort_run();
+    return REPLY_OK;
+}
+
+int cmd_readregs(const char *args) {
+    single_step_mode();
+    update();
+    read_all();
+    return REPLY_OK;
+}
+
+int cmd_benchmark(const char *args) {
+    // trigger to IO_UPDATE latency, see the Latency Benchmark section
+    uint steps = 1000;
+    parse(args, 0, "%u", &steps);
+    if (steps < 2 || steps > 65535) {
+        return fail("Invalid Argument - steps must be in range 2-65535");
+    }
+    benchmark(steps);
+    return REPLY_OK;
+}
+
+// =====================================
+// Banks and flash
+// =====================================
+
+int cmd_bank(const char *args) {
+    // selects the bank that table commands write to, with no argument
+    // prints the bank being edited and the bank that is running
+    uint bank;
+    if (!parse(args, 0, "%u", &bank)) {
+        printf("%u %u\n", edit_bank, run_bank);
+        return REPLY_DONE;
+    }
+    if (bank >= num_banks) {
+        return fail("Invalid Bank - bank must be in range 0-%u", num_banks - 1);
+    }
+    select_bank(bank);
+    return REPLY_OK;
+}
+
+int cmd_banks(const char *args) {
+    uint n;
+    if (!parse(args, 1, "%u", &n)) return REPLY_DONE;
+    if (n < 1 || n > MAX_BANKS) {
+        return fail("Invalid Argument - number of banks must be in range 1-%d", MAX_BANKS);
+    }
+    if (TIMERS * 4 >= (MAX_SIZE / n)) {
+        return fail("Invalid Argument - banks too small to hold a timing table");
+    }
+    split_banks(n);
+    return REPLY_OK;
+}
+
+int cmd_swap(const char *args) {
+    // switches the running table over to another bank, when 0 at the end
+    // of the current pass and when 1 on the next trigger
+    uint bank, when;
+    if (!parse(args, 2, "%u %u", &bank, &when)) return REPLY_DONE;
+    if (bank >= num_banks) {
+        return fail("Invalid Bank - bank must be in range 0-%u", num_banks - 1);
+    }
+    if (when > NEXT_TRIGGER) {
+        return fail("Invalid Argument - when must be 0 (end of table) or 1 (next trigger)");
+    }
+    if (get_status() != RUNNING) {
+        return fail("Not Running - use start to run a bank");
+    }
+    if (bank == edit_bank) save_layout();
+    swap_when = when;
+    pending_bank = bank;
+    return REPLY_OK;
+}
+
+int cmd_load(const char *args) {
+    // copies a flash slot into the bank being edited, layout and all
+    char name[SLOT_NAME] = DEFAULT_SLOT;
+    parse(args, 0, "%15s", name);
+    int slot = find_slot(name);
+    if (slot < 0) return fail("Invalid Slot - nothing is saved as %s", name);
+
+    if (!slot_valid(slot)) return fail("Invalid Slot - %s failed its CRC check", name);
+    const slot_header *h = slot_at(slot);
+    const uint8_t *data = slot_data(slot);
+    if (h->length > (h->layout.timing ? TIMING_OFFSET : bank_size)) {
+        return fail("Invalid Slot - %s does not fit in a bank of %u bytes", name, bank_size);
+    }
+    const uint32_t *waits = (const uint32_t *)(data + h->waits_at);
+    memcpy(table, data, h->length);
+    memcpy(table + TIMING_OFFSET, waits, h->waits * 4);
+    banks[edit_bank] = h->layout;
+    restore_layout();
+    return REPLY_OK;
+}
+
+int cmd_save(const char *args) {
+    // saves the bank being edited up to its end record, over a slot with
+    // the same name or into the least worn free one
+    char name[SLOT_NAME] = DEFAULT_SLOT;
+    parse(args, 0, "%15s", name);
+
+    save_layout();
+    const table_bank *layout = &banks[edit_bank];
+    uint size = record_size(layout);
+    uint space = (layout->timing ? TIMING_OFFSET : bank_size) - records_offset(layout);
+    uint limit = space / size;
+    uint end = table_end(layout, table, limit);
+    if (end == limit) return fail("Invalid Table - end the table with set 4 or set 5 first");
+
+    int slot = find_slot(name);
+    if (slot < 0) {
+        for (uint i = 0; i < NUM_SLOTS; i++) {
+            if (!slot_used(i) && (slot < 0 || slot_wear(i) < slot_wear(slot))) slot = i;
+        }
+    }
+    if (slot < 0) return fail("Flash Full - all %u slots are in use", (uint)NUM_SLOTS);
+
+    slot_header h;
+    memset(&h, 0, sizeof h);
+    h.magic = SLOT_MAGIC;
+    strcpy(h.name, name);
+    h.layout = *layout;
+    h.length = records_offset(layout) + (end + 1) * size;
+    if (layout->sparse) {
+        // the records and the index after them
+        const sparse_header *s = (const sparse_header *)table;
+        h.length = s->index_at + s->records * 4;
+    }
+    h.waits = layout->timing ? end : 0;
+    h.waits_at = (h.length + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+    const uint32_t *waits = (const uint32_t *)(table + TIMING_OFFSET);
+    h.crc = slot_crc(&h, table, waits);
+    uint erased = slot_write(slot, &h, table, waits);
+
+    // read it back through XIP
+    if (!slot_valid(slot)) {
+        return fail("Flash Error - slot %d did not read back as written", slot);
+    }
+    if (DEBUG) {
+        printf("slot %d: %u sectors erased\n", slot, erased);
+    }
+    return REPLY_OK;
+}
+
+int cmd_slots(const char *args) {
+    // the tables in flash as "slot name bytes type channels timing wear",
+    // wear is the erase count of the slot's most worn sector
+    for (uint i = 0; i < NUM_SLOTS; i++) {
+        if (!slot_used(i)) continue;
+        const slot_header *h = slot_at(i);
+        printf("%u %s %u %d %u %d %u\n", i, h->name, h->length, h->layout.sweep_type,
+               h->layout.channels, h->layout.timing, slot_wear(i));
+    }
+    return REPLY_OK;
+}
+
+int cmd_delete(const char *args) {
+    char name[SLOT_NAME];
+    if (!parse(args, 1, "%15s", name)) return REPLY_DONE;
+    int slot = find_slot(name);
+    if (slot < 0) return fail("Invalid Slot - nothing is saved as %s", name);
+    slot_delete(slot);
+    return REPLY_OK;
+}
+
+// =====================================
+// Table programming
+// =====================================
+
+int cmd_bulk(const char *args) {
+    // offset is a byte offset into the instruction buffer, so the timing
+    // table can be written by starting at TIMING_OFFSET
+    uint start, len;
+    if (!parse(args, 2, "%u %u", &start, &len)) return REPLY_DONE;
+    if (start > bank_size || len > bank_size - start) {
+        return fail("Invalid Range - upload must fit within %u bytes", bank_size);
+    }
+    bulk_load(start, len);
+    return REPLY_DONE;
+}
+
+int cmd_mode(const char *args) {
+    // mode <type> <timing> [sparse], a sparse table starts out empty
+    int type, _timing, _sparse = 0;
+    if (!parse(args, 2, "%d %d %d", &type, &_timing, &_sparse)) return REPLY_DONE;
+    if (type < SS_MODE || type > PHASE2_MODE) {
+        return fail("Invalid Type - table type must be in range 0-6");
+    }
+
+    ad9959.sweep_type = type;
+    INS_SIZE = ins_sizes[type];
+    timing = _timing;
+    sparse = _sparse;
+    if (sparse) {
+        palette_size = palette_used = 0;
+        sparse_clear();
+    }
+
+    // sweep instructions carry their own CFR, single step needs it
+    // reset. background() does that itself when the bank is run.
+    if (type == SS_MODE && get_status() == STOPPED) {
+        single_step_mode();
+        update();
+    }
+    return REPLY_OK;
+}
+
+int cmd_label(const char *args) {
+    // label <name> <addr> names an address for set to jump, loop or call
+    // to, label clear drops them all and with no arguments they are listed
+    char name[LABEL_NAME];
+    uint addr;
+    int parsed = parse(args, 0, "%7s %u", name, &addr);
+    if (!parsed) {
+        for (uint i = 0; i < num_labels; i++) printf("%s %u\n", labels[i].name, labels[i].addr);
+        return REPLY_OK;
+    }
+    if (strcmp(name, "clear") == 0) {
+        num_labels = 0;
+        return REPLY_OK;
+    }
+    if (!parse(args, 2, "%7s %u", name, &addr)) return REPLY_DONE;
+    if (addr >= max_instructions()) {
+        return fail("Invalid Address - label must be in range 0-%u", max_instructions() - 1);
+    }
+    if (!set_label(name, addr)) {
+        return fail("Labels Full - at most %d labels, use label clear", MAX_LABELS);
+    }
+    return REPLY_OK;
+}
+
+int cmd_pack(const char *args) {
+    // pack <entries> starts the bank being edited over as a packed table
+    // with room for that many palette entries, set and the pattern commands
+    // fill them as they go. Set the mode and channels first. A host that
+    // packs tables itself uploads the palette with bulk, followed by the
+    // records at entries * instruction size, and gives the number of
+    // entries it sent as used. With no arguments prints the palette size
+    // and how much of it is used, 0 entries goes back to raw records.
+    uint entries, used = 0;
+    int parsed = parse(args, 0, "%u %u", &entries, &used);
+    if (!parsed) {
+        printf("%u %u\n", palette_size, palette_used);
+        return REPLY_DONE;
+    }
+    if (sparse) {
+        return fail("Invalid Table - sparse tables are not packed, set the mode without sparse");
+    }
+    if (entries > PALETTE_MAX) {
+        return fail("Invalid Argument - palette can hold at most %d entries", PALETTE_MAX);
+    }
+    if (used > entries) {
+        return fail("Invalid Argument - used must be at most the number of entries");
+    }
+
+    palette_size = entries;
+    palette_used = used;
+    if (parsed < 2) memset(table, 0, timing ? TIMING_OFFSET : bank_size);
+    return REPLY_OK;
+}
+
+int cmd_setchannels(const char *args) {
+    uint channels;
+    if (!parse(args, 1, "%u", &channels)) return REPLY_DONE;
+    if (channels < 1 || channels > 4) {
+        return fail("Invalid Argument - number of channels must be in range 1-4");
+    }
+    ad9959.channels = channels;
+    return REPLY_OK;
+}
+
+int table_full() {
+    if (sparse) return fail("Table Full - no room left in the bank for another record");
+    return fail("Palette Full - table needs more than %u palette entries", palette_size);
+}
+
+int set_control_args(uint channel, uint addr, int values, const double *v) {
+    if (addr == max_instructions()) {
+        return fail("Invalid Address - last address is reserved for ending the table");
+    }
+    if (channel == WAIT_CHANNEL) {
+        if (values < 1) return fail("Missing Argument - wait expects a pin level");
+        uint8_t op = v[0] ? CTRL_WAIT_HIGH : CTRL_WAIT_LOW;
+        if (!set_control(addr, op, 0, 0)) return table_full();
+        return REPLY_OK;
+    }
+    if (channel == RETURN_CHANNEL) {
+        if (!set_control(addr, CTRL_RETURN, 0, 0)) return table_full();
+        return REPLY_OK;
+    }
+
+    if (values < 1) return fail("Missing Argument - expected a target address or label");
+    if (v[0] < 0 || v[0] >= max_instructions()) {
+        return fail("Invalid Address - target must be in range 0-%u", max_instructions() - 1);
+    }
+    uint8_t op = values < 2 ? CTRL_JUMP : v[1] ? CTRL_JUMP_HIGH : CTRL_JUMP_LOW;
+    uint32_t count = 0;
+    if (channel == CALL_CHANNEL) {
+        op = CTRL_CALL;
+    } else if (channel == LOOP_CHANNEL) {
+        if (values < 2) return fail("Missing Argument - loop expects a target and a count");
+        if (v[1] < 1) return fail("Invalid Argument - loop count must be at least 1");
+        op = CTRL_LOOP;
+        count = round(v[1]);
+    }
+    if (!set_control(addr, op, round(v[0]), count)) return table_full();
+    return REPLY_OK;
+}
+
+int cmd_set(const char *args) {
+    // single step:   set <channel:int> <addr:int> <freq> <amp> <phase> [time]
+    // sweeps (1-3):  set <channel:int> <addr:int> <start> <end> <delta> <rate> [time]
+    // sweeps (4-6):  set <channel:int> <addr:int> <start> <end> <delta> <rate> <ss1> <ss2> [time]
+    // end of table:  set 4 <addr:int> (stop) or set 5 <addr:int> [passes:int] (repeat)
+    // control:       set 6 <addr:int> <level:int> (wait for the feedback pin)
+    //                set 7 <addr:int> <target> [level:int] (jump, if the pin is at level)
+    //                set 8 <addr:int> <target> <count:int> (run from target count times)
+    //                set 9 <addr:int> <target> (call) or set 10 <addr:int> (return)
+    // targets are an address or a label. A sparse table is set in order, a
+    // record at a time, and leaves out single step values given as negative.
+    uint channel, addr;
+    double v[7];
+    int parsed = parse(args, 2, "%u %u %lf %lf %lf %lf %lf %lf %lf", &channel, &addr, v, v + 1,
+                       v + 2, v + 3, v + 4, v + 5, v + 6);
+    if (!parsed) return REPLY_DONE;
+
+    char name[LABEL_NAME];
+    if (parsed == 2 && channel >= JUMP_CHANNEL && channel <= CALL_CHANNEL) {
+        int named = sscanf(args, "%*u %*u %7s %lf", name, v + 1);
+        if (named > 0) {
+            int label = find_label(name);
+            if (label < 0) return fail("Invalid Label - no label called \"%s\"", name);
+            v[0] = labels[label].addr;
+            parsed += named;
+        }
+    }
+
+    int type = ad9959.sweep_type;
+    int values = type == SS_MODE ? 3 : type <= PHASE_MODE ? 4 : 6;
+    uint min_time = type == SS_MODE ? WAITS_SS_BASE + WAITS_SS_PER * ad9959.channels
+                                    : WAITS_SW_BASE + WAITS_SW_PER * ad9959.channels;
+
+    if (addr > max_instructions()) {
+        return fail("Invalid Address - table can hold at most %u instructions",
+                    max_instructions());
+    }
+    if (sparse && !sparse_in_order(addr)) {
+        return fail("Invalid Address - sparse tables are written in order, next address is %u",
+                    sparse_table()->records);
+    }
+    if (channel == STOP_CHANNEL || channel == REPEAT_CHANNEL) {
+        if (!set_end(addr, channel == REPEAT_CHANNEL, parsed > 2 ? round(v[0]) : 0)) {
+            return table_full();
+        }
+        return REPLY_OK;
+    }
+    if (channel >= WAIT_CHANNEL && channel <= RETURN_CHANNEL) {
+        return set_control_args(channel, addr, parsed - 2, v);
+    }
+    if (channel >= ad9959.channels) {
+        return fail("Invalid Channel - table only has %u channels", ad9959.channels);
+    }
+    if (addr == max_instructions()) {
+        return fail("Invalid Address - last address is reserved for ending the table");
+    }
+    if (parsed < 2 + values + timing) {
+        return fail("Missing Argument - mode %d expects %d values%s", type, values,
+                    timing ? " and a time" : "");
+    }
+    if (timing && v[values] < min_time) {
+        return fail("Invalid Time - minimum wait for this mode is %u cycles", min_time);
+    }
+    if (type != SS_MODE && (v[3] < 1 || v[3] > 255)) {
+        return fail("Invalid Rate - sweep rate must be in range 1-255");
+    }
+
+    bool stored = type == SS_MODE ? set_single_step(addr, channel, v[0], v[1], v[2])
+                                  : set_sweep(addr, channel, v[0], v[1], v[2], v[3], v[4], v[5]);
+    if (!stored) return table_full();
+    if (timing) {
+        set_time(addr, round(v[values]));
+    }
+    return REPLY_OK;
+}
+
+int start_run(const char *args, uint32_t flags) {
+    // runs the bank being edited, or a flash slot in place when one is named
+    char name[SLOT_NAME];
+    if (parse(args, 0, "%15s", name)) {
+        int slot = find_slot(name);
+        if (slot < 0) return fail("Invalid Slot - nothing is saved as %s", name);
+        if (!slot_valid(slot)) return fail("Invalid Slot - %s failed its CRC check", name);
+        multicore_fifo_push_blocking(slot << START_BANK_SHIFT | START_FLASH | flags);
+        return REPLY_OK;
+    }
+
+    // the start message carries the bank to run in the upper bits
+    save_layout();
+    multicore_fifo_push_blocking(edit_bank << START_BANK_SHIFT | flags);
+    return REPLY_OK;
+}
+
+int cmd_start(const char *args) { return start_run(args, 0); }
+
+int cmd_hwstart(const char *args) { return start_run(args, START_HW); }
+
+int cmd_stream(const char *args) {
+    int hwstart = 0;
+    parse(args, 0, "%d", &hwstart);
+    if (palette_size) {
+        return fail("Invalid Table - streams are raw records, use pack 0 first");
+    }
+    if (sparse) {
+        return fail("Invalid Table - streams are raw records, set the mode without sparse");
+    }
+    stream_load(hwstart);
+    return REPLY_DONE;
+}
+
+// =====================================
+// Patterns and calibration
+// =====================================
+
+bool pattern_ready() {
+    if (!pattern.begun) fail("No Pattern - start one with patbegin first");
+    return pattern.begun;
+}
+
+int cmd_patbegin(const char *args) {
+    uint channels;
+    if (!parse(args, 1, "%u", &channels)) return REPLY_DONE;
+    if (channels < 1 || channels > 4) {
+        return fail("Invalid Argument - number of channels must be in range 1-4");
+    }
+    pattern_begin(channels);
+    return REPLY_OK;
+}
+
+int cmd_patstep(const char *args) {
+    // a negative freq or amp leaves it as it was, a dwell of 0 applies
+    // the step together with the next one. dwell is in microseconds.
+    pattern_step step;
+    double freq, amp;
+    if (!parse(args, 4, "%u %lf %lf %u", &step.channel, &freq, &amp, &step.dwell)) {
+        return REPLY_DONE;
+    }
+    if (!pattern_ready()) return REPLY_DONE;
+    if (step.channel >= ad9959.channels) {
+        return fail("Invalid Channel - pattern only has %u channels", ad9959.channels);
+    }
+    if (step.dwell > MAX_PATTERN_US) {
+        return fail("Invalid Time - dwell must be at most %u us", MAX_PATTERN_US);
+    }
+
+    step.freq = freq < 0 ? KEEP_FREQ : (uint64_t)llround(freq * 1000);
+    step.amp = amp < 0 ? KEEP_AMP : llround(amp * 1000000);
+    if (!pattern_add(&step)) {
+        return fail("Pattern Full - table can hold at most %u steps", max_instructions());
+    }
+    return REPLY_OK;
+}
+
+int cmd_patmove(const char *args) {
+    // glides a channel between two frequencies in Hz over duration
+    // microseconds. A negative start moves from where the channel is. The
+    // profile is 0 = linear, 1 = minimum jerk (default) and 2 = cosine.
+    uint channel, duration;
+    double start, end;
+    int profile = MOVE_MIN_JERK;
+    if (!parse(args, 4, "%u %lf %lf %u %d", &channel, &start, &end, &duration, &profile)) {
+        return REPLY_DONE;
+    }
+    if (!pattern_ready()) return REPLY_DONE;
+    if (channel >= ad9959.channels) {
+        return fail("Invalid Channel - pattern only has %u channels", ad9959.channels);
+    }
+    if (duration > MAX_PATTERN_US) {
+        return fail("Invalid Time - duration must be at most %u us", MAX_PATTERN_US);
+    }
+    if (profile < MOVE_LINEAR || profile > MOVE_COSINE) {
+        return fail("Invalid Argument - profile must be 0 (linear), 1 (min jerk) or 2 (cosine)");
+    }
+    if (end < 0) {
+        return fail("Invalid Argument - end frequency must not be negative");
+    }
+
+    uint64_t from = start < 0 ? KEEP_FREQ : (uint64_t)llround(start * 1000);
+    if (!pattern_move(channel, from, llround(end * 1000), duration, profile)) {
+        return fail("Pattern Full - table can hold at most %u steps", max_instructions());
+    }
+    return REPLY_OK;
+}
+
+int cmd_patsite(const char *args) {
+    // a step to a site by name or index, with the site's amplitude
+    uint channel, dwell;
+    char name[SITE_NAME];
+    if (!parse(args, 3, "%u %7s %u", &channel, name, &dwell)) return REPLY_DONE;
+    if (!pattern_ready()) return REPLY_DONE;
+    if (channel >= ad9959.channels) {
+        return fail("Invalid Channel - pattern only has %u channels", ad9959.channels);
+    }
+    if (dwell > MAX_PATTERN_US) {
+        return fail("Invalid Time - dwell must be at most %u us", MAX_PATTERN_US);
+    }
+    int site = find_site(name);
+    if (site < 0) return fail("Invalid Site - no site called \"%s\"", name);
+
+    pattern_step step = {channel, AT_SITE(site), dwell};
+    if (!pattern_add(&step)) {
+        return fail("Pattern Full - table can hold at most %u steps", max_instructions());
+    }
+    return REPLY_OK;
+}
+
+int cmd_patend(const char *args) {
+    uint passes = 0;
+    parse(args, 0, "%u", &passes);
+    if (!pattern_ready()) return REPLY_DONE;
+    if (!pattern_end(passes)) {
+        return fail("Pattern Full - table can hold at most %u steps", max_instructions());
+    }
+    return REPLY_OK;
+}
+
+int run_preset(const pattern_preset *preset) {
+    // built in patterns, compiled into the table and started right away
+    if (!pattern_load(preset)) {
+        return fail("Pattern Full - table can hold at most %u steps", max_instructions());
+    }
+    save_layout();
+    multicore_fifo_push_blocking(edit_bank << START_BANK_SHIFT);
+    return REPLY_OK;
+}
+
+int cmd_rearrange(const char *args) {
+    // bitmaps in hex with bit 0 for the lowest site. Without a target the
+    // atoms are packed into the lowest sites.
+    uint32_t occupied, target = 0;
+    uint move_us = REARRANGE_MOVE_US;
+    int parsed = parse(args, 1, "%x %x %u", &occupied, &target, &move_us);
+    if (!parsed) return REPLY_DONE;
+    if (move_us > MAX_PATTERN_US) {
+        return fail("Invalid Time - move_us must be at most %u us", MAX_PATTERN_US);
+    }
+
+    uint32_t all = (1u << sites.count) - 1;
+    uint atoms = __builtin_popcount(occupied);
+    if (parsed < 2) target = (1u << atoms) - 1;
+    if ((occupied | target) & ~all) {
+        return fail("Invalid Argument - bitmaps only have %u sites", sites.count);
+    }
+    if ((uint)__builtin_popcount(target) > atoms) {
+        return fail("Invalid Argument - %u atoms cannot fill %u sites", atoms,
+                    __builtin_popcount(target));
+    }
+
+    if (!rearrange(occupied, target, move_us)) {
+        return fail("Pattern Full - table can hold at most %u steps", max_instructions());
+    }
+    save_layout();
+    multicore_fifo_push_blocking(edit_bank << START_BANK_SHIFT);
+    return REPLY_OK;
+}
+
+int cmd_site(const char *args) {
+    // with no arguments lists the sites, otherwise sets or adds one with the
+    // frequency in Hz. Without an amplitude the calibration gives it.
+    uint index;
+    char name[SITE_NAME];
+    double freq, amp = -1;
+    if (!parse(args, 0, "%u %7s %lf %lf", &index, name, &freq, &amp)) {
+        for (uint i = 0; i < sites.count; i++) {
+            const tweezer_site *site = get_site(i);
+            printf("%u %s %.3f %.6f\n", i, site->name, site->freq / 1000.0, site->amp / 1e6);
+        }
+        return REPLY_OK;
+    }
+    if (!parse(args, 3, "%u %7s %lf %lf", &index, name, &freq, &amp)) return REPLY_DONE;
+    if (index > sites.count || index >= MAX_SITES) {
+        return fail("Invalid Site - index must be in range 0-%u",
+                    sites.count < MAX_SITES ? sites.count : MAX_SITES - 1);
+    }
+
+    uint64_t mhz = llround(freq * 1000);
+    uint32_t ppm;
+    if (amp < 0) {
+        uint8_t ftw[4];
+        ppm = cal_asf(get_ftw_mhz(&ad9959, mhz, ftw));
+    } else {
+        ppm = llround(amp * 1000000);
+    }
+    set_site(index, name, mhz, ppm);
+    return REPLY_OK;
+}
+
+int cmd_calibrate(const char *args) {
+    // frequencies in MHz and increasing, at least 2 and at most 13 points
+    float x[MAX_POINTS], y[MAX_POINTS];
+    uint n = 0;
+    int used;
+    while (n < MAX_POINTS && sscanf(args, "%f %f%n", x + n, y + n, &used) == 2) {
+        args += used;
+        n++;
+    }
+    if (n < 2) {
+        return fail("Missing Argument - expected: %s %s", current->name, current->usage);
+    }
+    if (!cal_fit(x, y, n)) {
+        return fail("Invalid Argument - calibration frequencies must be increasing");
+    }
+    return REPLY_OK;
+}
+
+// =====================================
+// Setting channels directly
+// =====================================
+
+int cmd_setfreq(const char *args) {
+    uint channel;
+    double freq;
+    uint8_t ftw[4];
+    if (!parse(args, 2, "%u %lf", &channel, &freq)) return REPLY_DONE;
+    if (!valid_channel(channel)) return REPLY_DONE;
+
+    freq = get_ftw(&ad9959, freq, ftw);
+    send_channel(0x04, channel, ftw, 4);
+    update();
+
+    if (DEBUG) {
+        printf("set freq: %lf\n", freq);
+    }
+    return REPLY_OK;
+}
+
+int cmd_setamp(const char *args) {
+    uint channel;
+    double amp;
+    uint8_t asf[3];
+    if (!parse(args, 2, "%u %lf", &channel, &amp)) return REPLY_DONE;
+    if (!valid_channel(channel)) return REPLY_DONE;
+
+    amp = get_asf(amp, asf);
+    send_channel(0x06, channel, asf, 3);
+    update();
+
+    if (DEBUG) {
+        printf("Amp: %12lf\n", amp);
+    }
+    return REPLY_OK;
+}
+
+int cmd_setphase(const char *args) {
+    uint channel;
+    double phase;
+    uint8_t pow[2];
+    if (!parse(args, 2, "%u %lf", &channel, &phase)) return REPLY_DONE;
+    if (!valid_channel(channel)) return REPLY_DONE;
+
+    phase = get_pow(phase, pow);
+    send_channel(0x05, channel, pow, 2);
+    update();
+
+    if (DEBUG) {
+        printf("set phase: %lf\n", phase);
+    }
+    return REPLY_OK;
+}
+
+int cmd_settone(const char *args) {
+    // settone <channel> <freq> <amp> ..., every channel given changes on the
+    // same IO_UPDATE from one frame
+    uint8_t frame[4 * TONE_FRAME_MAX];
+    uint8_t *ins = frame;
+    uint channel, n = 0;
+    double freq, amp;
+    int used;
+    while (n < 4 && sscanf(args, "%u %lf %lf%n", &channel, &freq, &amp, &used) == 3) {
+        if (!valid_channel(channel)) return REPLY_DONE;
+        uint8_t ftw[4], asf[3];
+        get_ftw(&ad9959, freq, ftw);
+        get_asf(amp, asf);
+        ins = put_tone(ins, 1u << channel, ftw, NULL, asf);
+        args += used;
+        n++;
+    }
+    if (n == 0) {
+        return fail("Missing Argument - expected: %s %s", current->name, current->usage);
+    }
+    send_frame(frame, ins - frame);
+    update();
+    return REPLY_OK;
+}
+
+int cmd_sweepamp(const char *args) {
+    // ramps channel 0 from 0.65 to 0.7 once every 50 ms, the pass length of
+    // the old loop of 50 writes 1 ms apart. The ramp now runs on the AD9959,
+    // which cannot go that slowly: 0.05 of full scale is 51 ASF steps and the
+    // slowest rate is 255 sync clocks a step, so at 500 MHz the ramp is done
+    // in about 100 us and holds 0.7 for the rest of the pass.
+    uint channel = 0;
+    double freq = 85.5 * 1000000;
+    uint8_t ftw[4];
+    uint8_t asf[3];
+    freq = get_ftw(&ad9959, freq, ftw);
+    send_channel(0x04, channel, ftw, 4);
+    update();
+    for (int j = 1; j < 1000; j++) {
+        ramp(channel, 0, 0.65, 0.7, 0.001, 255);
+        sleep_ms(50);
+    }
+
+    // back to single tones before turning the channel off
+    single_step_mode();
+    get_asf(0, asf);
+    send_channel(0x06, channel, asf, 3);
+    update();
+    return REPLY_DONE;
+}
+
+int cmd_ramp(const char *args) {
+    // ramp <channel:int> <type:int> <start> <end> <delta> <rate:int>, the type
+    // is the sweep mode (1 = amplitude, 2 = frequency, 3 = phase) and the
+    // values are in the units of set
+    uint channel, type, rate;
+    double start, end, delta;
+    if (!parse(args, 6, "%u %u %lf %lf %lf %u", &channel, &type, &start, &end, &delta, &rate)) {
+        return REPLY_DONE;
+    }
+    if (!valid_channel(channel)) return REPLY_DONE;
+    if (type < AMP_MODE || type > PHASE_MODE) {
+        return fail("Invalid Type - ramp type must be 1 (amplitude), 2 (frequency) or 3 (phase)");
+    }
+    if (rate < 1 || rate > 255) {
+        return fail("Invalid Rate - sweep rate must be in range 1-255");
+    }
+    if (delta <= 0) {
+        return fail("Invalid Argument - delta must be positive");
+    }
+    ramp(channel, type - 1, start, end, delta, rate);
+    return REPLY_OK;
+}
+
+int cmd_interpolate(const char *args) {
+    // steps channel 0 across the tweezer array with the calibrated
+    // amplitude at each frequency. This stays in software: the tones are
+    // held 3 ms apiece and each needs its own amplitude, which a linear sweep
+    // of one parameter cannot give.
+    uint channel = 0;
+    uint8_t ftw[4];
+    uint8_t asf[3];
+    uint8_t frame[TONE_FRAME_MAX];
+    get_asf(0.5, asf);
+    send_channel(0x06, channel, asf, 3);
+    update();
+    for (int j = 0; j <= 200; j++) {
+        for (int i = 85; i <= 120; i++) {
+            uint32_t word = get_ftw_mhz(&ad9959, (i * 1000 + 500) * 1000000ull, ftw);
+            get_asf_ppm(cal_asf(word), asf);
+            send_frame(frame, put_tone(frame, 1u << channel, ftw, NULL, asf) - frame);
+            update();
+            sleep_ms(3);
+        }
+        get_asf(0, asf);
+        send_channel(0x06, channel, asf, 3);
+        update();
+        sleep_ms(1);
+    }
+    return REPLY_OK;
+}
+
+int cmd_freq_and_amp(const char *args) {
+    // steps channel 0 through whole MHz tones, 2 ms each, printing every one.
+    // It is a staircase of held tones rather than a ramp, so it is left to
+    // software instead of the sweep accumulators.
+    uint channel = 0;
+    double freq;
+    uint8_t ftw[4];
+    double amp = 1.0;
+    uint8_t asf[3];
+    amp = get_asf(amp, asf);
+    send_channel(0x06, channel, asf, 3);
+    update();
+    printf("set amp: %.2f\n", amp);
+    for (int j = 0; j < 500; j++) {
+        for (int i = 85; i <= 121; i++) {
+            freq = (i + 0.5) * 1000000.0;
+            freq = get_ftw(&ad9959, freq, ftw);
+            send_channel(0x04, channel, ftw, 4);
+            update();
+            sleep_ms(2);
+            printf("Frequency in MHz:%2f\n", (i + 0.5));
+        }
+    }
+    return REPLY_DONE;
+}
+
+// sorted by name (strcmp order) for the binary search in find_command()
+static const command commands[] = {
+    {"Interpolate", cmd_interpolate, 0, ""},
+    {"abort", cmd_abort, CMD_ANYTIME, ""},
+    {"bank", cmd_bank, CMD_ANYTIME, "[bank:int]"},
+    {"banks", cmd_banks, 0, "<num:int>"},
+    {"benchmark", cmd_benchmark, 0, "[steps:int]"},
+    {"bulk", cmd_bulk, CMD_EDIT, "<offset:int> <length:int>"},
+    {"calibrate", cmd_calibrate, CMD_ANYTIME, "<freq:float> <amp:float> ..."},
+    {"debug", cmd_debug, CMD_ANYTIME, "<on|off>"},
+    {"delete", cmd_delete, 0, "<slot>"},
+    {"freq_and_amp", cmd_freq_and_amp, 0, ""},
+    {"getfreqs", cmd_getfreqs, CMD_ANYTIME, ""},
+    {"hwplay", cmd_hwplay, 0, "<on|off>"},
+    {"hwstart", cmd_hwstart, 0, "[slot]"},
+    {"label", cmd_label, CMD_ANYTIME, "[name|clear] [addr:int]"},
+    {"load", cmd_load, 0, "[slot]"},
+    {"mode", cmd_mode, CMD_EDIT, "<type:int> <timing:int> [sparse:int]"},
+    {"numtriggers", cmd_numtriggers, CMD_ANYTIME, ""},
+    {"pack", cmd_pack, CMD_EDIT, "[entries:int] [used:int]"},
+    {"patbegin", cmd_patbegin, CMD_EDIT, "<channels:int>"},
+    {"patend", cmd_patend, CMD_EDIT, "[passes:int]"},
+    {"patmove", cmd_patmove, CMD_EDIT,
+     "<channel:int> <start:float> <end:float> <duration:int> [profile:int]"},
+    {"patsite", cmd_patsite, CMD_EDIT, "<channel:int> <site> <dwell:int>"},
+    {"patstep", cmd_patstep, CMD_EDIT, "<channel:int> <freq:float> <amp:float> <dwell:int>"},
+    {"ramp", cmd_ramp, 0, "<channel:int> <type:int> <start> <end> <delta> <rate:int>"},
+    {"readregs", cmd_readregs, 0, ""},
+    {"rearrange", cmd_rearrange, 0, "<occupied:hex> [target:hex] [move_us:int]"},
+    {"reset", cmd_reset, CMD_ANYTIME, ""},
+    {"save", cmd_save, 0, "[slot]"},
+    {"set", cmd_set, CMD_EDIT, "<channel:int> <addr:int> ..."},
+    {"setamp", cmd_setamp, 0, "<channel:int> <amp:float>"},
+    {"setchannels", cmd_setchannels, CMD_EDIT, "<num:int>"},
+    {"setfreq", cmd_setfreq, 0, "<channel:int> <frequency:float>"},
+    {"setphase", cmd_setphase, 0, "<channel:int> <phase:float>"},
+    {"settone", cmd_settone, 0, "<channel:int> <freq:float> <amp:float> ..."},
+    {"site", cmd_site, CMD_ANYTIME, "[index:int] [name] [freq:float] [amp:float]"},
+    {"slots", cmd_slots, 0, ""},
+    {"start", cmd_start, 0, "[slot]"},
+    {"status", cmd_status, CMD_ANYTIME, ""},
+    {"stream", cmd_stream, 0, "[hwstart:int]"},
+    {"swap", cmd_swap, CMD_ANYTIME, "<bank:int> <when:int>"},
+    {"sweepamp", cmd_sweepamp, 0, ""},
+    {"telemetry", cmd_telemetry, 0, "[records:int]"},
+    {"underruns", cmd_underruns, CMD_ANYTIME, ""},
+    {"version", cmd_version, CMD_ANYTIME, ""},
+};
+
+const command *find_command(const char *name, size_t len) {
+    int lo = 0, hi = sizeof commands / sizeof commands[0] - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strncmp(name, commands[mid].name, len);
+        if (cmp == 0 && commands[mid].name[len] != '\0') cmp = -1;
+        if (cmp == 0) return &commands[mid];
+        if (cmp < 0) {
+            hi = mid - 1;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+void loop() {
+    readline();
+
+    size_t len = strcspn(readstring, " \t\r");
+    const char *args = readstring + len;
+    const pattern_preset *preset = NULL;
+    int local_status = get_status();
+
+    current = find_command(readstring, len);
+    if (!current && !(preset = find_preset(readstring))) {
+        fail("Unknown Command - \"%s\"", readstring);
+        return;
+    }
+
+    // presets compile into the edit bank and start it, so they need the
+    // runner to be stopped like start does
+    uint flags = current ? current->flags : 0;
+    bool allowed = local_status == STOPPED || flags & CMD_ANYTIME ||
+                   (flags & CMD_EDIT && edit_bank != run_bank && (int)edit_bank != pending_bank);
+    if (!allowed) {
+        printf(
+            "Cannot execute command \"%s\" during buffered execution. Check "
+            "status first and wait for it to return %d (stopped or aborted).\n",
+            readstring, STOPPED);
+        return;
+    }
+
+    int reply = current ? current->run(args) : run_preset(preset);
+    if (reply == REPLY_OK) {
+        OK();
+    }
+}
+
+// =============================================================================
+// Initial Setup
+// =============================================================================
+
+int main() {
+    init_pin(PICO_DEFAULT_LED_PIN);
+    gpio_put(PICO_DEFAULT_LED_PIN, 1);
+
+    stdio_init_all();
+
+    // binary uploads read exactly as many bytes as they were promised
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    set_sys_clock_khz(125 * MHZ / 1000, false);
+
+    // output sys clock on a gpio pin to be used as REF_CLK for AD9959
+    clock_gpio_init(PIN_CLOCK, CLOCKS_CLK_GPOUT0_CTRL_AUXSRC_VALUE_CLK_SYS, 1);
+
+    // attatch spi to system clock so it runs at max rate
+    clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS, 125 * MHZ,
+                    125 * MHZ);
+
+    // init SPI, or the PIO program that stands in for it in 4-bit mode
+    if (SERIAL_BITS == 4) {
+        serial_quad_init(PIN_SDIO0, PIN_SCLK);
+    } else {
+        spi_init(spi1, 100 * MHZ);
+        spi_set_format(spi1, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+        gpio_set_function(PIN_MISO, GPIO_FUNC_SPI);
+        gpio_set_function(PIN_SCK, GPIO_FUNC_SPI);
+        gpio_set_function(PIN_MOSI, GPIO_FUNC_SPI);
+    }
+
+    // launch other core
+    multicore_launch_core1(background);
+    multicore_fifo_pop_blocking();
+
+    // initialise the status mutex
+    mutex_init(&status_mutex);
+    mutex_init(&wait_mutex);
 
     // init the PIO
     init_pio();
 
     // setup dma
+    spi_dma_init();
+    seq_init();
     timer_dma = dma_claim_unused_channel(true);
 
     // if pico is timing itself, it will use dma to send all the wait
@@ -1462,10 +3703,14 @@ int main() {
     // put AD9959 in default state
     init_pin(PIN_SYNC);
     init_pin(PIN_RESET);
+    gpio_init(PIN_FEEDBACK);
+    gpio_pull_down(PIN_FEEDBACK);
     set_ref_clk(&ad9959, 125 * MHZ);
     set_pll_mult(&ad9959, 4);
     reset();
 
+    cal_fit(cal_default_x, cal_default_y, sizeof cal_default_x / sizeof cal_default_x[0]);
+
     while (true) {
         loop();
     }
@@ -0,0 +1,116 @@
+/*
+This is a small benchmark for the tuning word conversions in ad9959.c. It
+times the double and the integer versions of each conversion with SysTick
+and prints the average cycles per call over USB every couple of seconds.
+It also checks that both versions produce the same bytes.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ad9959.h"
+#include "hardware/structs/systick.h"
+#include "pico/stdlib.h"
+
+#define CALLS 1000
+
+ad9959_config ad9959;
+uint8_t sink[4];
+
+static inline uint32_t ticks() { return systick_hw->cvr; }
+
+uint elapsed(uint32_t start) {
+    // SysTick counts down and is 24 bits wide
+    return (start - ticks()) & 0xffffff;
+}
+
+void bench_ftw() {
+    uint32_t start = ticks();
+    for (uint i = 0; i < CALLS; i++) {
+        get_ftw(&ad9959, 80 * MHZ + i * 1001, sink);
+    }
+    uint t_double = elapsed(start);
+
+    start = ticks();
+    for (uint i = 0; i < CALLS; i++) {
+        get_ftw_mhz(&ad9959, (80 * MHZ + i * 1001) * 1000ull, sink);
+    }
+    uint t_int = elapsed(start);
+
+    printf("ftw:   double %5u  int %5u cycles\n", t_double / CALLS, t_int / CALLS);
+}
+
+void bench_asf() {
+    uint32_t start = ticks();
+    for (uint i = 0; i < CALLS; i++) {
+        get_asf(i / 1000.0, sink);
+    }
+    uint t_double = elapsed(start);
+
+    start = ticks();
+    for (uint i = 0; i < CALLS; i++) {
+        get_asf_ppm(i * 1000, sink);
+    }
+    uint t_int = elapsed(start);
+
+    printf("asf:   double %5u  int %5u cycles\n", t_double / CALLS, t_int / CALLS);
+}
+
+void bench_pow() {
+    uint32_t start = ticks();
+    for (uint i = 0; i < CALLS; i++) {
+        get_pow(i * 0.36, sink);
+    }
+    uint t_double = elapsed(start);
+
+    start = ticks();
+    for (uint i = 0; i < CALLS; i++) {
+        get_pow_mdeg(i * 360, sink);
+    }
+    uint t_int = elapsed(start);
+
+    printf("pow:   double %5u  int %5u cycles\n", t_double / CALLS, t_int / CALLS);
+}
+
+void check() {
+    // whole Hz inputs have to give the same words
+    uint mismatches = 0;
+    uint8_t a[4], b[4];
+    for (uint32_t f = 1; f < 200 * MHZ; f += 9973) {
+        get_ftw(&ad9959, f, a);
+        get_ftw_mhz(&ad9959, f * 1000ull, b);
+        if (memcmp(a, b, 4)) mismatches++;
+    }
+    for (uint32_t p = 0; p <= 1000000; p += 7) {
+        get_asf(p / 1e6, a);
+        get_asf_ppm(p, b);
+        if (memcmp(a, b, 3)) mismatches++;
+    }
+    for (uint32_t p = 0; p < 360000; p += 7) {
+        get_pow(p / 1000.0, a);
+        get_pow_mdeg(p, b);
+        if (memcmp(a, b, 2)) mismatches++;
+    }
+    printf("check: %u mismatches\n", mismatches);
+}
+
+int main() {
+    set_sys_clock_khz(125 * MHZ / 1000, false);
+    stdio_init_all();
+
+    // only the conversions are used, the AD9959 does not need to be attached
+    ad9959.ref_clk = 125 * MHZ;
+    ad9959.pll_mult = 4;
+    set_ref_clk(&ad9959, 125 * MHZ);
+
+    systick_hw->rvr = 0xffffff;
+    systick_hw->csr = 0x5;
+
+    while (true) {
+        sleep_ms(2000);
+        bench_ftw();
+        bench_asf();
+        bench_pow();
+        check();
+    }
+}
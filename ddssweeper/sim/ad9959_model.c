@@ -0,0 +1,304 @@
+/*
+Register level model of the AD9959.
+
+Bytes from the SPI bus are parsed into register writes the way the chip
+does it in 3-wire mode. Frames from the 4-bit serial program are taken a
+nibble per clock, or just SDIO_0 when CSR has not switched the chip to 4-bit
+mode yet, and logged as qspi. CSR takes effect straight away. Every other register
+lands in the I/O buffer of each channel enabled in CSR and is copied to the
+active registers by IO_UPDATE. A frame only counts once its last bit is on
+the bus, so an IO_UPDATE that comes while a frame is still being clocked in
+is reported as late.
+
+DDS_SIM_LOG=<file> logs every SPI frame and IO_UPDATE with its time in
+microseconds, along with the outputs of the channels that changed.
+DDS_SIM_REFCLK sets the reference clock in Hz, it defaults to 125 MHz.
+*/
+
+#define SIM_INTERNAL
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define NUM_REGS 0x19
+#define CSR 0x00
+#define FR1 0x01
+#define FR2 0x02
+#define CFR 0x03
+#define CFTW 0x04
+#define CPOW 0x05
+#define ACR 0x06
+
+static const uint8_t reg_sizes[NUM_REGS] = {1, 3, 2, 3, 4, 2, 3, 2, 4, 4, 4, 4, 4,
+                                            4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4};
+
+typedef struct frame {
+    uint8_t *bytes;
+    size_t len;
+    uint64_t start, done;
+    // from the 4-bit serial program, a nibble per clock
+    bool quad;
+    struct frame *next;
+} frame;
+
+static struct {
+    // channel registers, FR1 and FR2 are kept with channel 0
+    uint8_t active[4][NUM_REGS][4];
+    uint8_t buffer[4][NUM_REGS][4];
+    uint8_t csr;
+
+    // parser state, the register being written and how far into it
+    int reg;
+    uint pos;
+    uint8_t data[4];
+    int read_reg;
+    // bits of the byte being clocked in by the 4-bit program
+    uint8_t shift;
+    uint bits;
+
+    // frames still being clocked in
+    frame *head, *tail;
+
+    double ref_clk;
+    FILE *log;
+
+    uint64_t frames, bytes, updates, late, missed;
+    // updates since the last sync, the firmware syncs at the start of a run
+    uint64_t run_updates, first_update, last_update;
+} dds;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double sys_clk(const uint8_t regs[NUM_REGS][4]) {
+    uint mult = (regs[FR1][0] >> 2) & 0x1f;
+    return dds.ref_clk * (mult >= 4 && mult <= 20 ? mult : 1);
+}
+
+// =============================================================================
+// Register writes
+// =============================================================================
+
+static bool is_global(int reg) { return reg == FR1 || reg == FR2; }
+
+static void commit_reg() {
+    uint size = reg_sizes[dds.reg];
+    if (dds.reg == CSR) {
+        dds.csr = dds.data[0];
+        return;
+    }
+    for (int ch = 0; ch < 4; ch++) {
+        if (is_global(dds.reg) ? ch == 0 : (dds.csr >> (ch + 4)) & 1) {
+            memcpy(dds.buffer[ch][dds.reg], dds.data, size);
+        }
+    }
+}
+
+static void parse_byte(uint8_t byte) {
+    if (dds.reg < 0) {
+        if (byte & 0x80) {
+            // a read, the bytes come back through ad9959_model_read
+            dds.read_reg = byte & 0x1f;
+        } else if ((byte & 0x1f) < NUM_REGS) {
+            dds.reg = byte & 0x1f;
+            dds.pos = 0;
+        }
+        return;
+    }
+
+    dds.data[dds.pos++] = byte;
+    if (dds.pos == reg_sizes[dds.reg]) {
+        commit_reg();
+        dds.reg = -1;
+    }
+}
+
+static void parse(const uint8_t *bytes, size_t len, bool quad) {
+    for (size_t i = 0; i < len; i++) {
+        if (!quad) {
+            parse_byte(bytes[i]);
+            continue;
+        }
+
+        // outside 4-bit mode only SDIO_0 is read, a bit per clock
+        for (int n = 4; n >= 0; n -= 4) {
+            uint8_t nibble = (bytes[i] >> n) & 0xf;
+            bool four = (dds.csr & 0x06) == 0x06;
+            dds.shift = four ? dds.shift << 4 | nibble : dds.shift << 1 | (nibble & 1);
+            dds.bits += four ? 4 : 1;
+            if (dds.bits == 8) {
+                parse_byte(dds.shift);
+                dds.bits = 0;
+            }
+        }
+    }
+}
+
+static void land_frames(uint64_t t) {
+    // everything fully on the bus by t is in the I/O buffers
+    while (dds.head && dds.head->done <= t) {
+        frame *f = dds.head;
+        parse(f->bytes, f->len, f->quad);
+        dds.head = f->next;
+        if (!dds.head) dds.tail = NULL;
+        free(f->bytes);
+        free(f);
+    }
+}
+
+void ad9959_model_write(const uint8_t *buf, size_t len, uint64_t start, uint64_t done,
+                        bool quad) {
+    pthread_mutex_lock(&lock);
+    land_frames(start);
+
+    frame *f = malloc(sizeof(frame));
+    f->bytes = malloc(len);
+    memcpy(f->bytes, buf, len);
+    f->len = len;
+    f->start = start;
+    f->done = done;
+    f->quad = quad;
+    f->next = NULL;
+    if (dds.tail) {
+        dds.tail->next = f;
+    } else {
+        dds.head = f;
+    }
+    dds.tail = f;
+
+    dds.frames++;
+    dds.bytes += len;
+    if (dds.log) {
+        fprintf(dds.log, "%12.3f %s", start / 1e3, quad ? "qspi" : "spi");
+        for (size_t i = 0; i < len; i++) fprintf(dds.log, " %02x", buf[i]);
+        fprintf(dds.log, "\n");
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void ad9959_model_read(uint8_t *buf, size_t len) {
+    pthread_mutex_lock(&lock);
+    land_frames(UINT64_MAX);
+
+    // channel registers read back from the lowest enabled channel
+    int reg = dds.read_reg < NUM_REGS ? dds.read_reg : CSR;
+    int ch = 0;
+    while (ch < 3 && !is_global(reg) && !((dds.csr >> (ch + 4)) & 1)) ch++;
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = reg == CSR ? dds.csr : i < reg_sizes[reg] ? dds.active[ch][reg][i] : 0;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// =============================================================================
+// IO_UPDATE
+// =============================================================================
+
+static void log_channel(int ch) {
+    uint8_t(*r)[4] = dds.active[ch];
+    uint32_t ftw = r[CFTW][0] << 24 | r[CFTW][1] << 16 | r[CFTW][2] << 8 | r[CFTW][3];
+    uint32_t pow = (r[CPOW][0] & 0x3f) << 8 | r[CPOW][1];
+    uint32_t asf = (r[ACR][1] & 0x03) << 8 | r[ACR][2];
+    double amp = r[ACR][1] & 0x10 ? asf / 1023.0 : 1.0;
+
+    fprintf(dds.log, "             ch%d f=%.3f a=%.4f p=%.3f", ch,
+            ftw * sys_clk(dds.active[0]) / 4294967296.0, amp, pow * 360.0 / 16384.0);
+
+    // sweeps run from the value above to the one in CW1
+    if (r[CFR][1] & 0x40) {
+        uint8_t type = r[CFR][0] >> 6;
+        const char *names[] = {"off", "amp", "freq", "phase"};
+        fprintf(dds.log, " sweep=%s cw1=%02x%02x%02x%02x", names[type], r[0x0a][0], r[0x0a][1],
+                r[0x0a][2], r[0x0a][3]);
+    }
+    fprintf(dds.log, "\n");
+}
+
+void ad9959_model_update(uint64_t t, uint8_t profile, uint8_t profile_after) {
+    pthread_mutex_lock(&lock);
+    land_frames(t);
+
+    // a frame caught half way through does not make it into this update
+    for (frame *f = dds.head; f && f->start < t; f = f->next) dds.late++;
+
+    dds.updates++;
+    if (dds.run_updates++ == 0) dds.first_update = t;
+    dds.last_update = t;
+
+    if (dds.log) fprintf(dds.log, "%12.3f update p=%x,%x\n", t / 1e3, profile, profile_after);
+    for (int ch = 0; ch < 4; ch++) {
+        bool changed = memcmp(dds.active[ch], dds.buffer[ch], sizeof dds.buffer[ch]) != 0;
+        memcpy(dds.active[ch], dds.buffer[ch], sizeof dds.buffer[ch]);
+        if (changed && dds.log) log_channel(ch);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void ad9959_model_missed(uint64_t t) {
+    pthread_mutex_lock(&lock);
+    dds.missed++;
+    if (dds.log) fprintf(dds.log, "%12.3f missed trigger\n", t / 1e3);
+    pthread_mutex_unlock(&lock);
+}
+
+// =============================================================================
+// Reset and reporting
+// =============================================================================
+
+void ad9959_model_reset() {
+    pthread_mutex_lock(&lock);
+    land_frames(UINT64_MAX);
+    memset(dds.active, 0, sizeof dds.active);
+    for (int ch = 0; ch < 4; ch++) {
+        // power on defaults from the datasheet
+        dds.active[ch][CFR][1] = 0x03;
+        dds.active[ch][CFR][2] = 0x02;
+        dds.active[ch][FR2][0] = 0x00;
+    }
+    memcpy(dds.buffer, dds.active, sizeof dds.active);
+    dds.csr = 0xf0;
+    dds.reg = -1;
+    dds.bits = 0;
+    dds.read_reg = CSR;
+    if (dds.log) fprintf(dds.log, "%12.3f reset\n", sim_now() / 1e3);
+    pthread_mutex_unlock(&lock);
+}
+
+void ad9959_model_sync() {
+    // resets the serial port, the next byte is an instruction
+    pthread_mutex_lock(&lock);
+    land_frames(UINT64_MAX);
+    dds.reg = -1;
+    dds.bits = 0;
+    dds.run_updates = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void ad9959_model_init() {
+    const char *ref = getenv("DDS_SIM_REFCLK");
+    dds.ref_clk = ref ? strtod(ref, NULL) : 125e6;
+
+    const char *path = getenv("DDS_SIM_LOG");
+    if (path) {
+        dds.log = fopen(path, "w");
+        if (!dds.log) perror("sim: could not open log");
+    }
+    ad9959_model_reset();
+}
+
+void ad9959_model_summary() {
+    pthread_mutex_lock(&lock);
+    double span = (dds.last_update - dds.first_update) / 1e9;
+    fprintf(stderr, "sim: %llu frames, %llu bytes, %llu updates, %llu late, %llu missed\n",
+            (unsigned long long)dds.frames, (unsigned long long)dds.bytes,
+            (unsigned long long)dds.updates, (unsigned long long)dds.late,
+            (unsigned long long)dds.missed);
+    if (dds.run_updates > 1 && span > 0) {
+        fprintf(stderr, "sim: %.0f updates/s since the last sync\n", (dds.run_updates - 1) / span);
+    }
+    if (dds.log) fflush(dds.log);
+    pthread_mutex_unlock(&lock);
+}
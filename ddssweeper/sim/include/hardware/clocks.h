@@ -0,0 +1,26 @@
+#ifndef _SIM_HARDWARE_CLOCKS_H
+#define _SIM_HARDWARE_CLOCKS_H
+
+#include "pico/stdlib.h"
+
+enum clock_index { clk_gpout0, clk_gpout1, clk_gpout2, clk_gpout3, clk_ref, clk_sys,
+                   clk_peri, clk_usb, clk_adc, clk_rtc, CLK_COUNT };
+
+#define CLOCKS_FC0_SRC_VALUE_PLL_SYS_CLKSRC_PRIMARY 0x01
+#define CLOCKS_FC0_SRC_VALUE_PLL_USB_CLKSRC_PRIMARY 0x02
+#define CLOCKS_FC0_SRC_VALUE_ROSC_CLKSRC 0x03
+#define CLOCKS_FC0_SRC_VALUE_CLK_SYS 0x09
+#define CLOCKS_FC0_SRC_VALUE_CLK_PERI 0x0a
+#define CLOCKS_FC0_SRC_VALUE_CLK_USB 0x0b
+#define CLOCKS_FC0_SRC_VALUE_CLK_ADC 0x0c
+#define CLOCKS_FC0_SRC_VALUE_CLK_RTC 0x0d
+#define CLOCKS_CLK_GPOUT0_CTRL_AUXSRC_VALUE_CLK_SYS 0x6
+#define CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS 0x1
+
+uint32_t frequency_count_khz(uint src);
+void clock_gpio_init(uint gpio, uint src, float div);
+bool clock_configure(enum clock_index clk, uint32_t src, uint32_t auxsrc, uint32_t src_freq,
+                     uint32_t freq);
+uint32_t clock_get_hz(enum clock_index clk);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef _SIM_HARDWARE_FLASH_H
+#define _SIM_HARDWARE_FLASH_H
+
+#include "pico/stdlib.h"
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+#define SIM_FLASH_SIZE PICO_FLASH_SIZE_BYTES
+
+void flash_range_erase(uint32_t offset, size_t count);
+void flash_range_program(uint32_t offset, const uint8_t *data, size_t count);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef _SIM_HARDWARE_PIO_H
+#define _SIM_HARDWARE_PIO_H
+
+#include "pico/stdlib.h"
+
+typedef struct {
+    volatile uint32_t txf[4];
+    volatile uint32_t rxf[4];
+    volatile uint32_t input_sync_bypass;
+    volatile uint32_t irq;
+    volatile uint32_t fdebug;
+} pio_hw_t;
+
+#define PIO_FDEBUG_TXSTALL_LSB 24
+
+typedef pio_hw_t *PIO;
+extern pio_hw_t sim_pio[2];
+#define pio0 (&sim_pio[0])
+#define pio1 (&sim_pio[1])
+
+typedef struct {
+    uint32_t clkdiv, execctrl, shiftctrl, pinctrl;
+} pio_sm_config;
+
+enum pio_src_dest {
+    pio_pins = 0,
+    pio_x = 1,
+    pio_y = 2,
+    pio_null = 3,
+    pio_isr = 6,
+    pio_osr = 7,
+};
+
+typedef struct {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+// programs are not executed, the simulator models what they do in sim_pio.c
+uint pio_add_program(PIO pio, const pio_program_t *program);
+int pio_claim_unused_sm(PIO pio, bool required);
+void pio_sm_claim(PIO pio, uint sm);
+void pio_sm_unclaim(PIO pio, uint sm);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t values, uint32_t mask);
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t dirs, uint32_t mask);
+void pio_gpio_init(PIO pio, uint pin);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+uint8_t pio_sm_get_pc(PIO pio, uint sm);
+bool pio_interrupt_get(PIO pio, uint irq);
+void pio_interrupt_clear(PIO pio, uint irq);
+
+// instructions run with pio_sm_exec are only of interest for what they load
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+uint pio_encode_pull(bool if_empty, bool block);
+uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src);
+uint pio_encode_out(enum pio_src_dest dest, uint count);
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm);
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm);
+
+#endif
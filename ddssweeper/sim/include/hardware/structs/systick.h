@@ -0,0 +1,17 @@
+#ifndef _SIM_HARDWARE_STRUCTS_SYSTICK_H
+#define _SIM_HARDWARE_STRUCTS_SYSTICK_H
+
+#include <stdint.h>
+
+typedef struct {
+    volatile uint32_t csr;
+    volatile uint32_t rvr;
+    volatile uint32_t cvr;
+    volatile uint32_t calib;
+} systick_hw_t;
+
+// the current value is worked out from the simulated time on every access
+systick_hw_t *sim_systick();
+#define systick_hw (sim_systick())
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef _SIM_HARDWARE_STRUCTS_WATCHDOG_H
+#define _SIM_HARDWARE_STRUCTS_WATCHDOG_H
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _SIM_HARDWARE_SYNC_H
+#define _SIM_HARDWARE_SYNC_H
+
+#include "pico/stdlib.h"
+
+#endif
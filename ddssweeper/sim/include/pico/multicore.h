@@ -0,0 +1,13 @@
+#ifndef _SIM_PICO_MULTICORE_H
+#define _SIM_PICO_MULTICORE_H
+
+#include "pico/stdlib.h"
+
+// core1 is a thread, the inter-core FIFOs are 8 deep like on the RP2040
+void multicore_launch_core1(void (*entry)(void));
+void multicore_fifo_push_blocking(uint32_t data);
+uint32_t multicore_fifo_pop_blocking(void);
+bool multicore_fifo_rvalid(void);
+bool multicore_fifo_wready(void);
+
+#endif
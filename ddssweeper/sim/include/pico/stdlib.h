@@ -0,0 +1,85 @@
+// Host stand-in for the parts of the pico-sdk the firmware uses. Only the
+// declarations live here, sim.c has the implementations.
+#ifndef _SIM_PICO_STDLIB_H
+#define _SIM_PICO_STDLIB_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+typedef unsigned int uint;
+
+#define KHZ 1000
+#define MHZ 1000000
+
+#define PICO_DEFAULT_LED_PIN 25
+#define PICO_ERROR_TIMEOUT -1
+
+#define GPIO_IN 0
+#define GPIO_OUT 1
+#define GPIO_FUNC_SPI 1
+#define GPIO_FUNC_SIO 5
+#define GPIO_FUNC_PIO0 6
+#define GPIO_FUNC_PIO1 7
+
+#define __not_in_flash_func(f) f
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+// flash is backed by an array, see hardware/flash.h
+extern uint8_t sim_flash[];
+#define XIP_BASE ((uintptr_t)sim_flash)
+#define PICO_FLASH_SIZE_BYTES (2u * 1024 * 1024)
+
+// gpio
+void gpio_init(uint pin);
+void gpio_set_dir(uint pin, bool out);
+void gpio_put(uint pin, bool value);
+bool gpio_get(uint pin);
+void gpio_set_function(uint pin, int fn);
+void gpio_pull_up(uint pin);
+void gpio_pull_down(uint pin);
+
+// time
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+void busy_wait_us_32(uint32_t us);
+// firmware spin loops give the other core's thread a chance to run
+static inline void tight_loop_contents(void) { sched_yield(); }
+
+// stdio
+bool stdio_init_all(void);
+int putchar_raw(int c);
+int getchar_timeout_us(uint32_t timeout_us);
+int sim_getchar(void);
+size_t sim_fread(void *buf, size_t size, size_t count, FILE *stream);
+
+// the firmware reads commands with getchar and binary payloads with fread,
+// both are routed through the simulator so it can exit cleanly on EOF
+#ifndef SIM_INTERNAL
+#define getchar() sim_getchar()
+#define fread(buf, size, count, stream) sim_fread(buf, size, count, stream)
+#endif
+
+// clocks and interrupts
+bool set_sys_clock_khz(uint32_t freq_khz, bool required);
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+static inline void __compiler_memory_barrier(void) { __atomic_signal_fence(__ATOMIC_SEQ_CST); }
+static inline void __dmb(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+// pico_sync
+typedef struct {
+    pthread_mutex_t lock;
+} mutex_t;
+
+void mutex_init(mutex_t *m);
+void mutex_enter_blocking(mutex_t *m);
+void mutex_exit(mutex_t *m);
+
+#endif
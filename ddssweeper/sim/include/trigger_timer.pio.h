@@ -0,0 +1,30 @@
+// Stand-in for the header pico_generate_pio_header makes from
+// trigger_timer.pio. The init functions hook the simulated state machines
+// up in sim_pio.c.
+#ifndef _SIM_TRIGGER_TIMER_PIO_H
+#define _SIM_TRIGGER_TIMER_PIO_H
+
+#include "hardware/pio.h"
+
+extern const pio_program_t trigger_program;
+extern const pio_program_t timer_program;
+extern const pio_program_t latency_program;
+extern const pio_program_t quad_serial_program;
+extern const pio_program_t step_frame_program;
+extern const pio_program_t step_frame_quad_program;
+extern const pio_program_t step_trigger_program;
+
+// public label in step_frame and step_frame_quad
+#define step_frame_offset_wait_update 5u
+
+void trigger_program_init(PIO pio, uint sm, uint offset, uint trigger_pin, uint p_pin,
+                          uint update_pin);
+void timer_program_init(PIO pio, uint sm, uint offset, uint trigger_pin);
+void latency_program_init(PIO pio, uint sm, uint offset, uint trigger_pin, uint update_pin);
+void quad_serial_program_init(PIO pio, uint sm, uint offset, uint data_pin, uint clk_pin);
+void step_frame_program_init(PIO pio, uint sm, uint offset, uint data_pin, uint data_pins,
+                             uint clk_pin);
+void step_trigger_program_init(PIO pio, uint sm, uint offset, uint trigger_pin, uint p_pin,
+                               uint update_pin);
+
+#endif
@@ -0,0 +1,583 @@
+/*
+Host implementations of the pico-sdk functions the firmware uses.
+
+Core1 runs as a thread and the inter-core FIFOs are condition variables.
+SPI transfers take as long as they would at the configured baud rate and
+hand their bytes to the AD9959 model. DMA channels that write to the SPI
+data register or the 4-bit serial state machine behave the same way, and
+the one that feeds the timer state machine is passed to sim_pio.c. Flash is an array that can be kept in a
+file between runs.
+
+Environment:
+  DDS_SIM_PTY=1        talk over a pseudo terminal instead of stdin/stdout,
+                       its path is printed on stderr
+  DDS_SIM_FLASH=<file> keep the flash contents in <file>
+*/
+
+#define SIM_INTERNAL
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/pio.h"
+#include "hardware/spi.h"
+#include "hardware/structs/systick.h"
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+#include "sim.h"
+
+// =============================================================================
+// Time
+// =============================================================================
+
+static uint64_t start_ns;
+
+static uint64_t host_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t sim_now() { return host_ns() - start_ns; }
+
+void sim_sleep_until(uint64_t t) {
+    // sleep most of the way and spin the rest, the scheduler is not precise
+    // enough for the short waits between table steps. Spinning yields so the
+    // other core still gets to run on a host with a single CPU.
+    uint64_t now = sim_now();
+    if (t > now + 200000) {
+        uint64_t ns = t - now - 100000;
+        struct timespec ts = {ns / 1000000000ull, ns % 1000000000ull};
+        nanosleep(&ts, NULL);
+    }
+    while (sim_now() < t) sched_yield();
+}
+
+uint32_t time_us_32() { return sim_now() / 1000; }
+
+uint64_t time_us_64() { return sim_now() / 1000; }
+
+void sleep_ms(uint32_t ms) { sim_sleep_until(sim_now() + ms * 1000000ull); }
+
+void sleep_us(uint64_t us) { sim_sleep_until(sim_now() + us * 1000); }
+
+void busy_wait_us_32(uint32_t us) { sleep_us(us); }
+
+systick_hw_t *sim_systick() {
+    // counts down from the reload value once per cycle, only core1 uses it
+    static systick_hw_t systick;
+    uint64_t reload = (uint64_t)systick.rvr + 1;
+    systick.cvr = systick.rvr - (sim_now() / SIM_NS_PER_CYCLE) % reload;
+    return &systick;
+}
+
+// =============================================================================
+// GPIO
+// =============================================================================
+
+#define NUM_PINS 30
+
+static int pin_function[NUM_PINS];
+static bool pin_state[NUM_PINS];
+
+void gpio_init(uint pin) {
+    pin_function[pin] = GPIO_FUNC_SIO;
+    pin_state[pin] = false;
+}
+
+void gpio_set_dir(uint pin, bool out) {}
+
+void gpio_put(uint pin, bool value) {
+    bool rising = value && !pin_state[pin];
+    pin_state[pin] = value;
+    if (!rising) return;
+
+    if (pin == SIM_PIN_SYNC) {
+        ad9959_model_sync();
+    } else if (pin == SIM_PIN_RESET) {
+        ad9959_model_reset();
+    } else if (pin == SIM_PIN_TRIGGER && pin_function[pin] == GPIO_FUNC_SIO) {
+        // the firmware driving the trigger line itself, as it does to abort
+        sim_pio_trigger_edge(sim_now());
+    }
+}
+
+// the feedback input is driven from outside, SIGUSR1 raises it and SIGUSR2
+// drops it. DDS_SIM_FEEDBACK=1 starts it high.
+static volatile sig_atomic_t feedback;
+
+static void feedback_signal(int sig) { feedback = sig == SIGUSR1; }
+
+bool gpio_get(uint pin) {
+    bool bit;
+    if (sim_pio_sdo(pin, &bit)) return bit;
+    return pin == SIM_PIN_FEEDBACK ? feedback : pin_state[pin];
+}
+
+void gpio_set_function(uint pin, int fn) { pin_function[pin] = fn; }
+
+void gpio_pull_up(uint pin) {}
+
+void gpio_pull_down(uint pin) {}
+
+void pio_gpio_init(PIO pio, uint pin) {
+    pin_function[pin] = pio == pio0 ? GPIO_FUNC_PIO0 : GPIO_FUNC_PIO1;
+}
+
+// =============================================================================
+// Stdio
+// =============================================================================
+
+static bool use_pty;
+static void wait_core1_idle(void);
+
+static void sim_exit() {
+    // let a table that is still running play out before reporting
+    wait_core1_idle();
+    fflush(stdout);
+    ad9959_model_summary();
+    exit(0);
+}
+
+static void open_pty() {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+        perror("sim: could not open a pty");
+        exit(1);
+    }
+
+    // raw input, but keep turning \n into \r\n like the pico's usb stdio
+    struct termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tio.c_oflag |= OPOST | ONLCR;
+    tcsetattr(fd, TCSANOW, &tio);
+
+    // hold the slave open so reads do not fail while no host is attached
+    int slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+    (void)slave;
+
+    fprintf(stderr, "sim: serial port is %s\n", ptsname(fd));
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+}
+
+bool stdio_init_all() {
+    use_pty = getenv("DDS_SIM_PTY") != NULL;
+    if (use_pty) open_pty();
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    return true;
+}
+
+int sim_getchar() {
+    fflush(stdout);
+    int c = getc(stdin);
+    if (c == EOF) sim_exit();
+    return c;
+}
+
+size_t sim_fread(void *buf, size_t size, size_t count, FILE *stream) {
+    fflush(stdout);
+    size_t got = fread(buf, size, count, stream);
+    if (got == 0 && feof(stream)) sim_exit();
+    return got;
+}
+
+int getchar_timeout_us(uint32_t timeout_us) {
+    fflush(stdout);
+    struct pollfd p = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&p, 1, timeout_us / 1000) <= 0) return PICO_ERROR_TIMEOUT;
+    return sim_getchar();
+}
+
+int putchar_raw(int c) {
+    // bypasses the \n translation on the pico, so bypass it here too
+    uint8_t byte = c;
+    fflush(stdout);
+    return write(STDOUT_FILENO, &byte, 1) == 1 ? c : EOF;
+}
+
+// =============================================================================
+// Clocks and interrupts
+// =============================================================================
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required) { return true; }
+
+uint32_t frequency_count_khz(uint src) {
+    switch (src) {
+        case CLOCKS_FC0_SRC_VALUE_PLL_SYS_CLKSRC_PRIMARY:
+        case CLOCKS_FC0_SRC_VALUE_CLK_SYS:
+        case CLOCKS_FC0_SRC_VALUE_CLK_PERI:
+            return SIM_SYS_CLK / 1000;
+        case CLOCKS_FC0_SRC_VALUE_PLL_USB_CLKSRC_PRIMARY:
+        case CLOCKS_FC0_SRC_VALUE_CLK_USB:
+        case CLOCKS_FC0_SRC_VALUE_CLK_ADC:
+            return 48000;
+        case CLOCKS_FC0_SRC_VALUE_CLK_RTC:
+            return 47;
+        default:
+            return 6500;
+    }
+}
+
+void clock_gpio_init(uint gpio, uint src, float div) {}
+
+bool clock_configure(enum clock_index clk, uint32_t src, uint32_t auxsrc, uint32_t src_freq,
+                     uint32_t freq) {
+    return true;
+}
+
+uint32_t clock_get_hz(enum clock_index clk) {
+    return clk == clk_usb || clk == clk_adc ? 48 * MHZ : SIM_SYS_CLK;
+}
+
+uint32_t save_and_disable_interrupts() { return 0; }
+
+void restore_interrupts(uint32_t status) {}
+
+// =============================================================================
+// Multicore
+// =============================================================================
+
+#define FIFO_DEPTH 8
+
+typedef struct fifo {
+    uint32_t data[FIFO_DEPTH];
+    uint head, count;
+    bool waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} fifo;
+
+static fifo to_core0 = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+static fifo to_core1 = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+static pthread_t core1;
+static bool core1_running;
+
+static bool on_core1() { return core1_running && pthread_equal(pthread_self(), core1); }
+
+static void *core1_entry(void *entry) {
+    ((void (*)(void))entry)();
+    return NULL;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    core1_running = true;
+    pthread_create(&core1, NULL, core1_entry, (void *)entry);
+}
+
+void multicore_fifo_push_blocking(uint32_t data) {
+    fifo *f = on_core1() ? &to_core0 : &to_core1;
+    pthread_mutex_lock(&f->lock);
+    while (f->count == FIFO_DEPTH) pthread_cond_wait(&f->cond, &f->lock);
+    f->data[(f->head + f->count++) % FIFO_DEPTH] = data;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+}
+
+uint32_t multicore_fifo_pop_blocking() {
+    fifo *f = on_core1() ? &to_core1 : &to_core0;
+    pthread_mutex_lock(&f->lock);
+    f->waiting = true;
+    pthread_cond_broadcast(&f->cond);
+    while (f->count == 0) pthread_cond_wait(&f->cond, &f->lock);
+    f->waiting = false;
+    uint32_t data = f->data[f->head];
+    f->head = (f->head + 1) % FIFO_DEPTH;
+    f->count--;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+    return data;
+}
+
+bool multicore_fifo_rvalid() {
+    fifo *f = on_core1() ? &to_core1 : &to_core0;
+    return f->count > 0;
+}
+
+bool multicore_fifo_wready() {
+    fifo *f = on_core1() ? &to_core0 : &to_core1;
+    return f->count < FIFO_DEPTH;
+}
+
+static void wait_core1_idle() {
+    // until it waits for a start command with none queued
+    pthread_mutex_lock(&to_core1.lock);
+    while (core1_running && !(to_core1.waiting && to_core1.count == 0)) {
+        pthread_cond_wait(&to_core1.cond, &to_core1.lock);
+    }
+    pthread_mutex_unlock(&to_core1.lock);
+}
+
+void mutex_init(mutex_t *m) { pthread_mutex_init(&m->lock, NULL); }
+
+void mutex_enter_blocking(mutex_t *m) { pthread_mutex_lock(&m->lock); }
+
+void mutex_exit(mutex_t *m) { pthread_mutex_unlock(&m->lock); }
+
+// =============================================================================
+// Flash
+// =============================================================================
+
+uint8_t sim_flash[SIM_FLASH_SIZE];
+
+static void flash_persist() {
+    const char *path = getenv("DDS_SIM_FLASH");
+    if (!path) return;
+    FILE *f = fopen(path, "wb");
+    if (!f) return;
+    fwrite(sim_flash, 1, SIM_FLASH_SIZE, f);
+    fclose(f);
+}
+
+void flash_range_erase(uint32_t offset, size_t count) {
+    memset(sim_flash + offset, 0xff, count);
+    flash_persist();
+}
+
+void flash_range_program(uint32_t offset, const uint8_t *data, size_t count) {
+    // programming can only clear bits
+    for (size_t i = 0; i < count; i++) sim_flash[offset + i] &= data[i];
+    flash_persist();
+}
+
+// =============================================================================
+// SPI
+// =============================================================================
+
+struct spi_inst {
+    spi_hw_t hw;
+    uint baudrate;
+};
+
+static struct spi_inst spi_insts[2];
+spi_inst_t *const spi0 = &spi_insts[0];
+spi_inst_t *const spi1 = &spi_insts[1];
+
+// transfers on the bus are back to back, this is when the last one ends
+static uint64_t spi_busy_until;
+static pthread_mutex_t spi_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate) {
+    // same divider search as the sdk, clk_peri runs at the system clock
+    uint64_t freq_in = SIM_SYS_CLK;
+    uint prescale, postdiv;
+    for (prescale = 2; prescale <= 254; prescale += 2) {
+        if (freq_in < (prescale + 2) * 256 * (uint64_t)baudrate) break;
+    }
+    for (postdiv = 256; postdiv > 1; --postdiv) {
+        if (freq_in / (prescale * (postdiv - 1)) > baudrate) break;
+    }
+    spi->baudrate = freq_in / (prescale * postdiv);
+    return spi->baudrate;
+}
+
+uint spi_init(spi_inst_t *spi, uint baudrate) { return spi_set_baudrate(spi, baudrate); }
+
+void spi_set_format(spi_inst_t *spi, uint data_bits, spi_cpol_t cpol, spi_cpha_t cpha,
+                    spi_order_t order) {}
+
+spi_hw_t *spi_get_hw(spi_inst_t *spi) { return &spi->hw; }
+
+uint spi_get_dreq(spi_inst_t *spi, bool is_tx) {
+    return spi == spi0 ? DREQ_SPI0_TX + !is_tx : DREQ_SPI1_TX + !is_tx;
+}
+
+bool spi_is_busy(const spi_inst_t *spi) { return sim_now() < spi_busy_until; }
+
+bool spi_is_readable(const spi_inst_t *spi) { return false; }
+
+static uint64_t bus_transfer(const uint8_t *src, size_t len, uint64_t start, uint64_t ns,
+                             bool quad) {
+    // queues len bytes behind whatever is on the bus and returns when they
+    // are done
+    pthread_mutex_lock(&spi_lock);
+    if (start < spi_busy_until) start = spi_busy_until;
+    uint64_t done = start + ns;
+    spi_busy_until = done;
+    if (src) ad9959_model_write(src, len, start, done, quad);
+    pthread_mutex_unlock(&spi_lock);
+    return done;
+}
+
+static uint64_t spi_transfer(spi_inst_t *spi, const uint8_t *src, size_t len) {
+    return bus_transfer(src, len, sim_now(), len * 8 * 1000000000ull / spi->baudrate, false);
+}
+
+uint64_t sim_quad_transfer(const uint8_t *src, size_t len) {
+    // two nibbles a byte and two cycles a nibble
+    return bus_transfer(src, len, sim_now(), len * 4 * SIM_NS_PER_CYCLE, true);
+}
+
+uint64_t sim_seq_transfer(const uint8_t *src, size_t len, uint64_t start, uint64_t ns, bool quad) {
+    return bus_transfer(src, len, start, ns, quad);
+}
+
+bool sim_serial_busy() { return sim_now() < spi_busy_until; }
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len) {
+    sim_sleep_until(spi_transfer(spi, src, len));
+    return len;
+}
+
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len) {
+    sim_sleep_until(spi_transfer(spi, NULL, len));
+    ad9959_model_read(dst, len);
+    return len;
+}
+
+// =============================================================================
+// DMA
+// =============================================================================
+
+static struct {
+    bool claimed;
+    volatile void *write_addr;
+    const volatile void *read_addr;
+    uint32_t count;
+    uint64_t busy_until;
+    // counting the pushes of step_trigger
+    bool counting;
+    dma_channel_hw_t hw;
+} dma[NUM_DMA_CHANNELS];
+
+static bool is_seq_count(uint channel) {
+    return dma[channel].read_addr == &pio0->rxf[SIM_SEQ_TRIG_SM];
+}
+
+static uint32_t seq_remaining(uint channel) {
+    if (!dma[channel].counting) return 0;
+    uint32_t fired = sim_pio_seq_fired();
+    return fired < dma[channel].count ? dma[channel].count - fired : 0;
+}
+
+int dma_claim_unused_channel(bool required) {
+    for (int i = 0; i < NUM_DMA_CHANNELS; i++) {
+        if (!dma[i].claimed) {
+            dma[i].claimed = true;
+            return i;
+        }
+    }
+    if (required) {
+        fprintf(stderr, "sim: no free DMA channels\n");
+        exit(1);
+    }
+    return -1;
+}
+
+void dma_channel_unclaim(uint channel) { dma[channel].claimed = false; }
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    return (dma_channel_config){0};
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) {}
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) {}
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq) {}
+
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to) {}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c,
+                                           enum dma_channel_transfer_size size) {}
+
+void channel_config_set_bswap(dma_channel_config *c, bool bswap) {}
+
+void dma_channel_start(uint channel) {
+    // only the destinations the firmware uses are modelled
+    if (dma[channel].write_addr == &spi_get_hw(spi1)->dr) {
+        dma[channel].busy_until =
+            spi_transfer(spi1, (const uint8_t *)dma[channel].read_addr, dma[channel].count);
+    } else if (dma[channel].write_addr == &pio1->txf[SIM_SERIAL_SM]) {
+        dma[channel].busy_until =
+            sim_quad_transfer((const uint8_t *)dma[channel].read_addr, dma[channel].count);
+    } else if (dma[channel].write_addr == &pio1->txf[0]) {
+        sim_pio_timer_dma(dma[channel].read_addr, dma[channel].count);
+    } else if (dma[channel].write_addr == &pio0->txf[SIM_SEQ_TRIG_SM]) {
+        sim_pio_seq_dma(SIM_SEQ_TRIG_SM, dma[channel].read_addr, dma[channel].count);
+    } else if (dma[channel].write_addr == &pio0->txf[SIM_SEQ_FRAME_SM]) {
+        sim_pio_seq_dma(SIM_SEQ_FRAME_SM, dma[channel].read_addr, dma[channel].count);
+    } else if (is_seq_count(channel)) {
+        dma[channel].counting = true;
+    }
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger) {
+    dma[channel].write_addr = write_addr;
+    dma[channel].read_addr = read_addr;
+    dma[channel].count = transfer_count;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger) {
+    dma[channel].read_addr = read_addr;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger) {
+    dma[channel].count = trans_count;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr,
+                                          uint32_t transfer_count) {
+    dma[channel].read_addr = read_addr;
+    dma[channel].count = transfer_count;
+    dma_channel_start(channel);
+}
+
+void dma_channel_abort(uint channel) {
+    if (dma[channel].write_addr == &pio1->txf[0]) sim_pio_timer_dma_abort();
+    dma[channel].busy_until = 0;
+    dma[channel].counting = false;
+}
+
+bool dma_channel_is_busy(uint channel) {
+    if (is_seq_count(channel)) return seq_remaining(channel) > 0;
+    return sim_now() < dma[channel].busy_until;
+}
+
+void dma_channel_wait_for_finish_blocking(uint channel) {
+    sim_sleep_until(dma[channel].busy_until);
+}
+
+dma_channel_hw_t *dma_channel_hw_addr(uint channel) {
+    if (is_seq_count(channel)) dma[channel].hw.transfer_count = seq_remaining(channel);
+    return &dma[channel].hw;
+}
+
+// =============================================================================
+// Startup
+// =============================================================================
+
+__attribute__((constructor)) static void sim_init() {
+    start_ns = host_ns();
+    memset(sim_flash, 0xff, SIM_FLASH_SIZE);
+
+    const char *path = getenv("DDS_SIM_FLASH");
+    FILE *f = path ? fopen(path, "rb") : NULL;
+    if (f) {
+        if (fread(sim_flash, 1, SIM_FLASH_SIZE, f) == 0) memset(sim_flash, 0xff, SIM_FLASH_SIZE);
+        fclose(f);
+    }
+
+    const char *level = getenv("DDS_SIM_FEEDBACK");
+    feedback = level && atoi(level);
+    signal(SIGUSR1, feedback_signal);
+    signal(SIGUSR2, feedback_signal);
+
+    ad9959_model_init();
+}
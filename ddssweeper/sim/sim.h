@@ -0,0 +1,58 @@
+/*
+Internal interface between the simulated peripherals and the AD9959 model.
+Times are nanoseconds since the simulator started.
+*/
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// board wiring, see the pin definitions in dds-sweeper.c
+#define SIM_PIN_SYNC 10
+#define SIM_PIN_RESET 9
+#define SIM_PIN_TRIGGER 8
+#define SIM_PIN_FEEDBACK 20
+// lowest of the four profile pins, P3
+#define SIM_PIN_PROFILE 16
+// state machine of the 4-bit serial program in ad9959.c
+#define SIM_SERIAL_SM 2
+// state machines of hardware playback on pio0
+#define SIM_SEQ_FRAME_SM 1
+#define SIM_SEQ_TRIG_SM 2
+
+// system clock the PIO programs count in
+#define SIM_SYS_CLK 125000000ull
+#define SIM_NS_PER_CYCLE 8
+
+uint64_t sim_now();
+void sim_sleep_until(uint64_t t);
+
+// the serial port to the AD9959, spi1 or the 4-bit program share it
+uint64_t sim_quad_transfer(const uint8_t *src, size_t len);
+bool sim_serial_busy();
+// a frame clocked out by step_frame, starting no earlier than start
+uint64_t sim_seq_transfer(const uint8_t *src, size_t len, uint64_t start, uint64_t ns, bool quad);
+
+// PIO state machines and the DMA channel that feeds the timer
+void sim_pio_trigger_edge(uint64_t t);
+void sim_pio_timer_dma(const volatile uint32_t *words, uint32_t count);
+void sim_pio_timer_dma_abort();
+bool sim_pio_sdo(uint32_t pin, bool *bit);
+void sim_pio_seq_dma(uint32_t sm, const volatile void *records, uint32_t count);
+uint32_t sim_pio_seq_fired();
+
+// AD9959 model
+void ad9959_model_init();
+void ad9959_model_reset();
+void ad9959_model_sync();
+void ad9959_model_write(const uint8_t *buf, size_t len, uint64_t start, uint64_t done,
+                        bool quad);
+void ad9959_model_read(uint8_t *buf, size_t len);
+void ad9959_model_update(uint64_t t, uint8_t profile, uint8_t profile_after);
+void ad9959_model_missed(uint64_t t);
+void ad9959_model_summary();
+
+#endif
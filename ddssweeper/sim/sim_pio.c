@@ -0,0 +1,756 @@
+/*
+Behavioural model of the programs in trigger_timer.pio.
+
+The programs are not executed. Instead the timer state machine is worked
+out as a schedule of trigger pulses from the words it is fed, and the
+trigger state machine fires on the first pulse that comes after it was
+armed.
+
+The simulator runs in real time, so a busy host can make the firmware late
+where the board would not be. A timer pulse that is over before the trigger
+state machine is armed is reported as missed. On the board the table would
+stall there, here the trigger fires late and the table carries on so that
+one slow step does not hang a run.
+
+When nothing on the board drives the trigger line (no timer words, or the
+timer is waiting for a hardware start) an external trigger is made up.
+DDS_SIM_TRIGGER_US sets the period of that external trigger. It defaults to
+0, which triggers as soon as the firmware is armed and so measures how fast
+the firmware can go. With a period set, edges that come while the firmware
+is still busy are reported as missed.
+
+The 4-bit serial program hands its bytes to the serial port in sim.c.
+
+Hardware playback, step_frame and step_trigger, is worked out a step at a
+time whenever the firmware looks at it. Each frame goes on the serial bus
+after the IO_UPDATE of the step before and the step is then armed and fired
+the same way as the trigger program.
+*/
+
+#define SIM_INTERNAL
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/pio.h"
+#include "sim.h"
+#include "trigger_timer.pio.h"
+
+// the timer holds the trigger pin high for 6 cycles and takes 10 cycles
+// plus its count for each word. Made up external triggers are 100 ns wide.
+#define TIMER_PULSE_NS (6 * SIM_NS_PER_CYCLE)
+#define TIMER_PULSE_DELAY_NS (3 * SIM_NS_PER_CYCLE)
+#define EXTERNAL_PULSE_NS 100
+#define TX_FIFO_DEPTH 4
+
+pio_hw_t sim_pio[2];
+
+static const uint16_t no_instructions[1];
+const pio_program_t trigger_program = {no_instructions, 1, -1};
+const pio_program_t timer_program = {no_instructions, 1, -1};
+const pio_program_t latency_program = {no_instructions, 1, -1};
+const pio_program_t quad_serial_program = {no_instructions, 1, -1};
+const pio_program_t step_frame_program = {no_instructions, 1, -1};
+const pio_program_t step_frame_quad_program = {no_instructions, 1, -1};
+const pio_program_t step_trigger_program = {no_instructions, 1, -1};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// =============================================================================
+// Trigger line
+// =============================================================================
+
+#define MAX_PULSES 64
+
+typedef struct pulse {
+    uint64_t t, width;
+    bool external;
+    // raised by the latency program, held until IO_UPDATE
+    bool latency;
+} pulse;
+
+// pulses that have not fired the trigger state machine yet, oldest first
+static pulse pulses[MAX_PULSES];
+static uint num_pulses;
+
+static void add_pulse(uint64_t t, uint64_t width, bool external, bool latency) {
+    if (num_pulses == MAX_PULSES) {
+        ad9959_model_missed(pulses[0].t);
+        memmove(pulses, pulses + 1, --num_pulses * sizeof(pulse));
+    }
+
+    // keep them sorted, made up and abort edges can land between timer pulses
+    uint i = num_pulses++;
+    while (i > 0 && pulses[i - 1].t > t) {
+        pulses[i] = pulses[i - 1];
+        i--;
+    }
+    pulses[i] = (pulse){t, width, external, latency};
+}
+
+static void drop_pulse(uint i) {
+    memmove(pulses + i, pulses + i + 1, (--num_pulses - i) * sizeof(pulse));
+}
+
+// =============================================================================
+// Timer state machine
+// =============================================================================
+
+// words come either one at a time from pio_sm_put or as a block from the
+// DMA channel, both are queued in order
+typedef struct timer_block {
+    const volatile uint32_t *words;
+    uint32_t word, count, next;
+    uint64_t avail;
+    bool from_dma;
+} timer_block;
+
+#define MAX_BLOCKS 32
+
+static struct {
+    timer_block blocks[MAX_BLOCKS];
+    uint head, num_blocks;
+    // when the state machine pulls its next word
+    uint64_t free_at;
+    // waiting on the trigger pin for a hardware start
+    bool hwstart;
+    uint64_t hwstart_at;
+    // the first pulse after a hardware start is part of the starting edge
+    bool merge_next;
+    // nonzero words fed since the fifos were last cleared
+    uint32_t words;
+    // pull times of the last words, a word sits in the fifo until then
+    uint64_t pulled[TX_FIFO_DEPTH + 1];
+    uint num_pulled;
+} timer;
+
+static void timer_queue(const volatile uint32_t *words, uint32_t word, uint32_t count,
+                        bool from_dma) {
+    if (timer.num_blocks == MAX_BLOCKS) {
+        fprintf(stderr, "sim: timer queue overflow\n");
+        exit(1);
+    }
+    uint i = (timer.head + timer.num_blocks++) % MAX_BLOCKS;
+    timer.blocks[i] = (timer_block){words, word, count, 0, sim_now(), from_dma};
+}
+
+static bool release_hwstart() {
+    // an external edge at or after the hardware start was pulled lets it go
+    for (uint i = 0; i < num_pulses; i++) {
+        if (pulses[i].external && pulses[i].t >= timer.hwstart_at) {
+            timer.hwstart = false;
+            timer.merge_next = true;
+            timer.free_at = pulses[i].t + SIM_NS_PER_CYCLE;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool timer_step() {
+    // runs the timer up to its next pulse. Returns false if it is stuck
+    // waiting for words or for a hardware start.
+    if (timer.hwstart) return release_hwstart();
+    if (timer.num_blocks == 0) return false;
+
+    timer_block *b = &timer.blocks[timer.head];
+    uint32_t word = b->words ? b->words[b->next] : b->word;
+    uint64_t pull = b->avail > timer.free_at ? b->avail : timer.free_at;
+    if (++b->next == b->count) {
+        timer.head = (timer.head + 1) % MAX_BLOCKS;
+        timer.num_blocks--;
+    }
+
+    if (timer.num_pulled == TX_FIFO_DEPTH + 1) {
+        memmove(timer.pulled, timer.pulled + 1, TX_FIFO_DEPTH * sizeof(uint64_t));
+        timer.num_pulled--;
+    }
+    timer.pulled[timer.num_pulled++] = pull;
+
+    if (word == 0) {
+        timer.hwstart = true;
+        timer.hwstart_at = pull;
+        release_hwstart();
+        return true;
+    }
+
+    if (timer.merge_next) {
+        timer.merge_next = false;
+    } else {
+        add_pulse(pull + TIMER_PULSE_DELAY_NS, TIMER_PULSE_NS, false, false);
+    }
+    timer.free_at = pull + ((uint64_t)word + 10) * SIM_NS_PER_CYCLE;
+    return true;
+}
+
+static void timer_clear(bool dma_only) {
+    // drop the words that were not pulled yet
+    uint kept = 0;
+    for (uint i = 0; i < timer.num_blocks; i++) {
+        timer_block *b = &timer.blocks[(timer.head + i) % MAX_BLOCKS];
+        if (!dma_only || !b->from_dma) timer.blocks[(timer.head + kept++) % MAX_BLOCKS] = *b;
+    }
+    timer.num_blocks = kept;
+    if (dma_only) return;
+
+    // anything worked out past now was still in the fifo
+    uint64_t now = sim_now();
+    for (uint i = num_pulses; i-- > 0;) {
+        if (!pulses[i].external && pulses[i].t > now) drop_pulse(i);
+    }
+    if (timer.free_at > now) timer.free_at = now;
+    timer.hwstart = false;
+    timer.merge_next = false;
+    timer.words = 0;
+    timer.num_pulled = 0;
+}
+
+void sim_pio_timer_dma(const volatile uint32_t *words, uint32_t count) {
+    if (count == 0) return;
+    pthread_mutex_lock(&lock);
+    timer_queue(words, 0, count, true);
+    timer.words += count;
+    pthread_mutex_unlock(&lock);
+}
+
+void sim_pio_timer_dma_abort() {
+    pthread_mutex_lock(&lock);
+    timer_clear(true);
+    pthread_mutex_unlock(&lock);
+}
+
+// =============================================================================
+// Latency state machine
+// =============================================================================
+
+// the benchmark program on pio1 sm1, it raises the trigger a gap after each
+// IO_UPDATE and pushes how long the IO_UPDATE took to come
+#define LATENCY_SM 1
+#define RX_FIFO_DEPTH 4
+
+static struct {
+    bool enabled;
+    uint32_t gap;
+    uint64_t next_edge;
+    bool raised;
+    uint32_t rx[RX_FIFO_DEPTH];
+    uint rx_head, rx_count;
+} latency;
+
+static bool latency_edge() {
+    // raises the line unless the last count is still waiting to be pushed
+    if (latency.raised || latency.rx_count == RX_FIFO_DEPTH) return false;
+    add_pulse(latency.next_edge, UINT64_MAX / 2, true, true);
+    latency.raised = true;
+    return true;
+}
+
+static void latency_fired(uint64_t edge, uint64_t t) {
+    // the program counts down x two cycles at a time. The trigger program
+    // takes a cycle to answer and IO_UPDATE goes through 2 synchroniser
+    // stages on the way back.
+    uint32_t count = (t - edge + 3 * SIM_NS_PER_CYCLE) / (2 * SIM_NS_PER_CYCLE);
+    latency.rx[(latency.rx_head + latency.rx_count++) % RX_FIFO_DEPTH] = ~count;
+    latency.raised = false;
+    latency.next_edge = t + ((uint64_t)latency.gap + 8) * SIM_NS_PER_CYCLE;
+}
+
+// =============================================================================
+// Trigger state machine
+// =============================================================================
+
+static struct {
+    bool armed;
+    uint32_t value;
+    uint64_t armed_at;
+    // when the armed state machine fires, once that is known
+    bool scheduled;
+    uint64_t fire_at;
+    // pushed after the IO_UPDATE and not read yet
+    bool rx;
+    // profile pins
+    uint8_t pins;
+    // last external edge, for counting the ones the firmware was too slow for
+    uint64_t last_edge;
+    bool edges;
+    uint64_t period;
+} trig;
+
+static void external_edge(uint64_t armed_at) {
+    // the next edge of the made up external trigger
+    uint64_t t = armed_at;
+    if (trig.period) {
+        t = (armed_at + trig.period - 1) / trig.period * trig.period;
+        if (trig.edges) {
+            uint64_t e = (trig.last_edge / trig.period + 1) * trig.period;
+            for (uint n = 0; e < t && n < 100000; e += trig.period, n++) ad9959_model_missed(e);
+        }
+    }
+    trig.last_edge = t;
+    trig.edges = true;
+    add_pulse(t, EXTERNAL_PULSE_NS, true, false);
+}
+
+static uint64_t trigger_fire() {
+    uint64_t a = trig.armed_at;
+
+    while (true) {
+        if (num_pulses) {
+            // a pulse over before the state machine was armed would stall the
+            // table on the board, here it is reported and fires late
+            if (pulses[0].t + pulses[0].width <= a) ad9959_model_missed(pulses[0].t);
+
+            // the same edge also lets a waiting hardware start go
+            if (timer.hwstart) release_hwstart();
+            uint64_t t = pulses[0].t > a ? pulses[0].t : a;
+            if (pulses[0].latency) latency_fired(pulses[0].t, t);
+            drop_pulse(0);
+            return t;
+        }
+
+        if (timer_step()) continue;
+
+        // the line is only driven from outside when the timer is not
+        // running a table
+        if (latency.enabled && timer.words == 0) {
+            if (latency_edge()) continue;
+        } else if (timer.hwstart || timer.words == 0) {
+            external_edge(a);
+            continue;
+        }
+
+        // the timer ran out of words or the latency program is waiting for
+        // its count to be read, wait for that or for an abort
+        pthread_mutex_unlock(&lock);
+        sleep_us(50);
+        pthread_mutex_lock(&lock);
+    }
+}
+
+static bool trigger_rx() {
+    // works out when the armed state machine fires and does the IO_UPDATE
+    // once that time has come
+    if (trig.armed && !trig.scheduled) {
+        trig.fire_at = trigger_fire();
+        trig.scheduled = true;
+    }
+    if (trig.scheduled && sim_now() >= trig.fire_at) {
+        uint8_t after = (trig.value >> 4) & 0xf;
+        ad9959_model_update(trig.fire_at, trig.value & 0xf, after);
+        trig.pins = after;
+        trig.armed = false;
+        trig.scheduled = false;
+        trig.rx = true;
+    }
+    return trig.rx;
+}
+
+// =============================================================================
+// Hardware playback
+// =============================================================================
+
+// step_frame raises this once the first frame is out
+#define SEQ_ARMED_IRQ 3
+// from the IO_UPDATE to the first bit of the next frame
+#define SEQ_RESTART_NS (8 * SIM_NS_PER_CYCLE)
+
+static struct {
+    bool running;
+    const uint8_t *records;
+    uint32_t steps, fired;
+    // frame bytes, from Y of step_trigger, and data pins of step_frame
+    uint frame, data_pins;
+    uint64_t free_at, frame_done;
+    // the first step is not fired before the firmware saw it armed, until
+    // then nothing has started the timer of a timed table
+    bool armed, seen;
+} seq;
+
+static void seq_advance() {
+    while (seq.running && seq.fired < seq.steps) {
+        if (!trig.armed) {
+            const uint8_t *rec = seq.records + seq.fired * (seq.frame + 1);
+            bool quad = seq.data_pins == 4;
+            uint64_t ns = seq.frame * (quad ? 4 : 16) * SIM_NS_PER_CYCLE;
+            seq.frame_done = sim_seq_transfer(rec + 1, seq.frame, seq.free_at, ns, quad);
+            trig.armed = true;
+            trig.scheduled = false;
+            trig.value = rec[0];
+            trig.armed_at = seq.frame_done;
+            seq.armed = true;
+        }
+        if (!seq.seen) return;
+
+        if (!trig.scheduled) {
+            trig.fire_at = trigger_fire();
+            trig.scheduled = true;
+        }
+        if (sim_now() < trig.fire_at) return;
+
+        uint8_t after = (trig.value >> 4) & 0xf;
+        ad9959_model_update(trig.fire_at, trig.value & 0xf, after);
+        trig.pins = after;
+        trig.armed = false;
+        trig.scheduled = false;
+        seq.free_at = trig.fire_at + SEQ_RESTART_NS;
+        seq.fired++;
+    }
+}
+
+void sim_pio_seq_dma(uint32_t sm, const volatile void *records, uint32_t count) {
+    // both channels stream the same table, the trigger one starts the pass
+    if (sm != SIM_SEQ_TRIG_SM) return;
+    pthread_mutex_lock(&lock);
+    seq.records = (const uint8_t *)records;
+    seq.steps = seq.frame ? count / (seq.frame + 1) : 0;
+    seq.fired = 0;
+    seq.free_at = sim_now();
+    seq.frame_done = 0;
+    seq.armed = seq.seen = false;
+    pthread_mutex_unlock(&lock);
+}
+
+uint32_t sim_pio_seq_fired() {
+    pthread_mutex_lock(&lock);
+    uint32_t before = seq.fired;
+    seq_advance();
+    uint32_t fired = seq.fired;
+    pthread_mutex_unlock(&lock);
+    // the firmware spins on this, leave the other core some time
+    if (fired == before) sched_yield();
+    return fired;
+}
+
+static void seq_stop() {
+    // a step that was armed never fires
+    seq.running = false;
+    trig.armed = false;
+    trig.scheduled = false;
+}
+
+void step_frame_program_init(PIO pio, uint sm, uint offset, uint data_pin, uint data_pins,
+                             uint clk_pin) {
+    pthread_mutex_lock(&lock);
+    seq.data_pins = data_pins;
+    pthread_mutex_unlock(&lock);
+}
+
+void step_trigger_program_init(PIO pio, uint sm, uint offset, uint trigger_pin, uint p_pin,
+                               uint update_pin) {
+    pthread_mutex_lock(&lock);
+    seq_stop();
+    seq.steps = seq.fired = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+uint8_t pio_sm_get_pc(PIO pio, uint sm) {
+    // only asked of step_frame, which sits waiting for the IO_UPDATE once
+    // its frame is out and is in its bit loop before that
+    pthread_mutex_lock(&lock);
+    uint8_t pc = sim_now() >= seq.frame_done ? step_frame_offset_wait_update : 2;
+    pthread_mutex_unlock(&lock);
+    return pc;
+}
+
+bool pio_interrupt_get(PIO pio, uint irq) {
+    if (pio != pio0 || irq != SEQ_ARMED_IRQ) return false;
+    pthread_mutex_lock(&lock);
+    seq_advance();
+    bool set = seq.armed && sim_now() >= seq.frame_done;
+    if (set) seq.seen = true;
+    pthread_mutex_unlock(&lock);
+    if (!set) sched_yield();
+    return set;
+}
+
+void pio_interrupt_clear(PIO pio, uint irq) {}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr) {}
+
+uint pio_encode_pull(bool if_empty, bool block) { return 0; }
+
+uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src) { return 0; }
+
+uint pio_encode_out(enum pio_src_dest dest, uint count) { return 0; }
+
+void sim_pio_trigger_edge(uint64_t t) {
+    pthread_mutex_lock(&lock);
+    add_pulse(t, 1000000, true, false);
+    if (timer.hwstart) release_hwstart();
+    pthread_mutex_unlock(&lock);
+}
+
+// =============================================================================
+// SDK functions
+// =============================================================================
+
+uint pio_add_program(PIO pio, const pio_program_t *program) { return 0; }
+
+int pio_claim_unused_sm(PIO pio, bool required) { return 0; }
+
+void pio_sm_claim(PIO pio, uint sm) {}
+
+void pio_sm_unclaim(PIO pio, uint sm) {}
+
+// =============================================================================
+// 4-bit serial port
+// =============================================================================
+
+// Reads stop the program, turn SDIO_2 around and clock SCLK by hand. The
+// reply is taken from the model when SDIO_2 turns into an input and comes
+// out a bit per rising edge.
+static struct {
+    uint data_pin, clk_pin;
+    bool clk, reading;
+    uint8_t rx[4];
+    uint bit;
+} serial;
+
+static bool is_serial(PIO pio, uint sm) { return pio == pio1 && sm == SIM_SERIAL_SM; }
+
+void quad_serial_program_init(PIO pio, uint sm, uint offset, uint data_pin, uint clk_pin) {
+    pthread_mutex_lock(&lock);
+    serial.data_pin = data_pin;
+    serial.clk_pin = clk_pin;
+    pthread_mutex_unlock(&lock);
+}
+
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t dirs, uint32_t mask) {
+    uint32_t sdo = 1u << (serial.data_pin + 2);
+    if (!is_serial(pio, sm) || !(mask & sdo)) return;
+
+    pthread_mutex_lock(&lock);
+    serial.reading = !(dirs & sdo);
+    if (serial.reading) {
+        ad9959_model_read(serial.rx, sizeof serial.rx);
+        serial.bit = 0;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+bool sim_pio_sdo(uint32_t pin, bool *bit) {
+    pthread_mutex_lock(&lock);
+    bool reading = serial.reading && pin == serial.data_pin + 2;
+    if (reading) {
+        uint i = serial.bit / 8 % sizeof serial.rx;
+        *bit = (serial.rx[i] >> (7 - serial.bit % 8)) & 1;
+    }
+    pthread_mutex_unlock(&lock);
+    return reading;
+}
+
+static void serial_clock(uint32_t values, uint32_t mask) {
+    uint32_t clk = 1u << serial.clk_pin;
+    if (!(mask & clk)) return;
+    bool high = values & clk;
+    if (high && !serial.clk && serial.reading) serial.bit++;
+    serial.clk = high;
+}
+
+// =============================================================================
+// State machines
+// =============================================================================
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    if (pio == pio0 && sm == SIM_SEQ_TRIG_SM) {
+        pthread_mutex_lock(&lock);
+        if (enabled) {
+            seq.running = true;
+        } else {
+            seq_stop();
+        }
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    if (pio != pio1 || sm != LATENCY_SM) return;
+
+    pthread_mutex_lock(&lock);
+    if (enabled && !latency.enabled) {
+        latency.next_edge = sim_now() + ((uint64_t)latency.gap + 3) * SIM_NS_PER_CYCLE;
+    }
+    latency.enabled = enabled;
+    if (!enabled) {
+        // a raised edge nobody answered goes away with the state machine
+        for (uint i = num_pulses; i-- > 0;) {
+            if (pulses[i].latency) drop_pulse(i);
+        }
+        latency.raised = false;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t values, uint32_t mask) {
+    // only the profile pins of the trigger program and SCLK are tracked
+    if (is_serial(pio, sm)) {
+        pthread_mutex_lock(&lock);
+        serial_clock(values, mask);
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    if (pio != pio0) return;
+    uint8_t m = (mask >> SIM_PIN_PROFILE) & 0xf;
+    pthread_mutex_lock(&lock);
+    trig.pins = (trig.pins & ~m) | ((values >> SIM_PIN_PROFILE) & m);
+    pthread_mutex_unlock(&lock);
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    return (pio == pio0 ? 0 : 8) + (is_tx ? 0 : 4) + sm;
+}
+
+void trigger_program_init(PIO pio, uint sm, uint offset, uint trigger_pin, uint p_pin,
+                          uint update_pin) {
+    const char *period = getenv("DDS_SIM_TRIGGER_US");
+    pthread_mutex_lock(&lock);
+    trig.period = period ? strtod(period, NULL) * 1000 : 0;
+    trig.armed = false;
+    trig.scheduled = false;
+    trig.rx = false;
+    pthread_mutex_unlock(&lock);
+}
+
+void timer_program_init(PIO pio, uint sm, uint offset, uint trigger_pin) {}
+
+void latency_program_init(PIO pio, uint sm, uint offset, uint trigger_pin, uint update_pin) {
+    pio_sm_set_enabled(pio, sm, false);
+    pthread_mutex_lock(&lock);
+    latency.rx_count = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+    if (is_serial(pio, sm)) {
+        // the program shifts out the top byte
+        uint8_t byte = data >> 24;
+        sim_quad_transfer(&byte, 1);
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (pio == pio0 && sm == SIM_SEQ_TRIG_SM) {
+        // Y, the bytes to drop after the trigger byte less one
+        seq.frame = data + 1;
+    } else if (pio == pio0 && sm == SIM_SEQ_FRAME_SM) {
+        // Y of step_frame, worked out from the frame length instead
+    } else if (pio == pio1 && sm == LATENCY_SM) {
+        latency.gap = data;
+    } else if (pio == pio1) {
+        timer_queue(NULL, data, 1, false);
+        if (data) timer.words++;
+    } else if (data == 0) {
+        // IO_UPDATE straight away, the profile pins stay as they are
+        ad9959_model_update(sim_now(), trig.pins, trig.pins);
+    } else {
+        trig.armed = true;
+        trig.scheduled = false;
+        trig.value = data;
+        trig.armed_at = sim_now();
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+    while (pio_sm_is_tx_fifo_full(pio, sm)) sleep_us(10);
+    pio_sm_put(pio, sm, data);
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm) {
+    if (pio != pio0) return 0;
+
+    pthread_mutex_lock(&lock);
+    while (!trigger_rx() && trig.armed) {
+        uint64_t t = trig.fire_at;
+        pthread_mutex_unlock(&lock);
+        sim_sleep_until(t);
+        pthread_mutex_lock(&lock);
+    }
+    // with nothing put the board blocks here until an abort
+    trig.rx = false;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) {
+    if (pio == pio0) {
+        pthread_mutex_lock(&lock);
+        trigger_rx();
+        trig.rx = false;
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    if (pio != pio1 || sm != LATENCY_SM) return 0;
+
+    pthread_mutex_lock(&lock);
+    uint32_t data = latency.rx[latency.rx_head];
+    if (latency.rx_count) {
+        latency.rx_head = (latency.rx_head + 1) % RX_FIFO_DEPTH;
+        latency.rx_count--;
+    }
+    pthread_mutex_unlock(&lock);
+    return data;
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm) {
+    pthread_mutex_lock(&lock);
+    if (pio == pio1 && sm == LATENCY_SM) {
+        latency.rx_count = 0;
+    } else if (pio == pio1) {
+        timer_clear(false);
+    } else if (sm == SIM_SEQ_FRAME_SM || sm == SIM_SEQ_TRIG_SM) {
+        seq_stop();
+    } else {
+        trig.armed = false;
+        trig.scheduled = false;
+        trig.rx = false;
+        trig.edges = false;
+        num_pulses = 0;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm) {
+    if (is_serial(pio, sm)) return sim_serial_busy();
+    if (pio != pio1 || sm == LATENCY_SM) return 0;
+
+    pthread_mutex_lock(&lock);
+    // work the timer forward to now, words pulled later are still queued
+    uint64_t now = sim_now();
+    while (timer.num_blocks && !timer.hwstart && timer.free_at <= now && timer_step()) {
+    }
+    uint level = 0;
+    for (uint i = 0; i < timer.num_blocks; i++) {
+        timer_block *b = &timer.blocks[(timer.head + i) % MAX_BLOCKS];
+        level += b->count - b->next;
+    }
+    for (uint i = 0; i < timer.num_pulled; i++) {
+        if (timer.pulled[i] > now) level++;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return level > TX_FIFO_DEPTH ? TX_FIFO_DEPTH : level;
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) {
+    return pio_sm_get_tx_fifo_level(pio, sm) == TX_FIFO_DEPTH;
+}
+
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm) { return pio_sm_get_tx_fifo_level(pio, sm) == 0; }
+
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm) {
+    if (pio == pio0) {
+        pthread_mutex_lock(&lock);
+        uint level = trigger_rx();
+        pthread_mutex_unlock(&lock);
+        // the firmware spins on this, leave the other core some time
+        if (!level) sched_yield();
+        return level;
+    }
+    if (pio != pio1 || sm != LATENCY_SM) return 0;
+
+    pthread_mutex_lock(&lock);
+    uint level = latency.rx_count;
+    pthread_mutex_unlock(&lock);
+    return level;
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) { return pio_sm_get_rx_fifo_level(pio, sm) == 0; }